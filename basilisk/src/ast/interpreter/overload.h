@@ -24,6 +24,8 @@ void trash (void * alist) {}
 void NOT_UNUSED(){}
 static void tracing (const char * func, const char * file, int line) {}
 static void end_tracing (const char * func, const char * file, int line) {}
+static void tracing_function (const char * func, const char * file, int line) {}
+static void end_tracing_function (const char * func, const char * file, int line) {}
 void pmuntrace (void) {}
 void mpi_init() {}
 static void trace_off() {}
@@ -209,6 +209,8 @@ typedef struct {
 
 static Ast * argument_value (Ast * identifier, Stack * stack, const MacroReplacement * r)
 {
+  if (!r->sparameters)
+    return NULL;
   Ast * decl = ast_identifier_declaration (r->sparameters, ast_terminal (identifier)->start);
   if (!decl)
     return NULL;
@@ -538,7 +540,8 @@ void ast_macro_replacement (Ast * statement, Ast * initial, Stack * stack,
   if (!macro_statement)
     return;
 
-  if (!strcmp (ast_terminal (identifier)->start, "OMP_PARALLEL"))
+  if (!strcmp (ast_terminal (identifier)->start, "OMP_PARALLEL") ||
+      !strcmp (ast_terminal (identifier)->start, "OMP_SIMD"))
     return;
 
   if (!expand_definitions) {
@@ -661,9 +664,10 @@ void ast_macro_replacement (Ast * statement, Ast * initial, Stack * stack,
 
   Ast * copy = ast_copy (ast_find (macro_definition, sym_compound_statement));
   stack_push (stack, &copy);
-  if (r.parameters) {
+  if (r.parameters || r.initial) { // also for S__FILE__ and S_LINENO
     ast_traverse (copy, stack, replace_arguments, &r);
-    stack_destroy (r.sparameters);
+    if (r.sparameters)
+      stack_destroy (r.sparameters);
   }
   if (r.complex_call)
     ast_traverse (copy, stack, replace_return, &r);
@@ -357,9 +357,16 @@ static int independents (coord * p, int n)
 /**
 Given a volume fraction field *c* and a height function field *h*,
 this function returns the "mixed heights" parabola-fitted curvature
-(or *nodata* if the curvature cannot be computed). */
+(or *nodata* if the curvature cannot be computed).
 
-static double height_curvature_fit (Point point, scalar c, vector h)
+The parabolic fits need the interface normal and intercept. We use the
+[cached interface geometry](fractions.h#cached-interface-geometry) `g`
+if it is valid (it is filled at the end of the [VOF advection](vof.h)
+event). Otherwise [cached_normal()](fractions.h#cached_normal)
+reconstructs the interface with the same estimator,
+`interface_normal()`, so that both give identical curvatures. */
+
+static double height_curvature_fit (Point point, scalar c, vector h, scalar g)
 {
 
   /**
@@ -421,8 +428,8 @@ static double height_curvature_fit (Point point, scalar c, vector h)
   We recover the interface normal and the centroid of the interface
   fragment and initialize the parabolic fit. */
   
-  coord m = mycs (point, c), fc;
-  double alpha = plane_alpha (c[], m);
+  double alpha;
+  coord m = cached_normal (point, c, g, &alpha), fc;
   double area = plane_area_center (m, alpha, &fc);
   ParabolaFit fit;
   parabola_fit_init (&fit, fc, m);
@@ -452,15 +459,15 @@ static double height_curvature_fit (Point point, scalar c, vector h)
 
 If all else fails, we try a parabolic fit of interface centroids. */
 
-static double centroids_curvature_fit (Point point, scalar c)
+static double centroids_curvature_fit (Point point, scalar c, scalar g)
 {
 
   /**
   We recover the interface normal and the centroid of the interface
   fragment and initialize the parabolic fit. */
   
-  coord m = mycs (point, c), fc;
-  double alpha = plane_alpha (c[], m);
+  double alpha;
+  coord m = cached_normal (point, c, g, &alpha), fc;
   plane_area_center (m, alpha, &fc);
   ParabolaFit fit;
   parabola_fit_init (&fit, fc, m);
@@ -472,8 +479,8 @@ static double centroids_curvature_fit (Point point, scalar c)
   coord r = {x,y,z};
   foreach_neighbor(1)
     if (c[] > 0. && c[] < 1.) {
-      coord m = mycs (point, c), fc;
-      double alpha = plane_alpha (c[], m);
+      double alpha;
+      coord m = cached_normal (point, c, g, &alpha), fc;
       double area = plane_area_center (m, alpha, &fc);
       coord rn = {x,y,z};
       foreach_dimension()
@@ -564,6 +571,7 @@ cstats curvature (scalar c, scalar kappa,
   
   scalar k[];
   scalar_clone (k, kappa);
+  scalar g = interface_geometry_valid (c) ? c.geometry : (scalar){-1};
 
   foreach(reduction(+:sh) reduction(+:sf)) {
 
@@ -579,7 +587,7 @@ cstats curvature (scalar c, scalar kappa,
     
     else if ((k[] = height_curvature (point, c, h)) != nodata)
       sh++;
-    else if ((k[] = height_curvature_fit (point, c, h)) != nodata)
+    else if ((k[] = height_curvature_fit (point, c, h, g)) != nodata)
       sf++;
   }
   
@@ -609,7 +617,7 @@ cstats curvature (scalar c, scalar kappa,
 	/**
 	Empty neighborhood: we try centroids as a last resort. */
 
-	kf = centroids_curvature_fit (point, c), sc++;
+	kf = centroids_curvature_fit (point, c, g), sc++;
     }
     else
       kf = nodata;
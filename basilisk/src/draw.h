@@ -3,6 +3,7 @@
 */
 
 #include <ctype.h>
+#include <stdarg.h>
 #include "fractions.h"
 #include "gl/font.h"
 
@@ -44,7 +45,9 @@ void clear()
 * *camera*: predefined camera angles: "left", "right", "top",
    "bottom", "front", "back" and "iso".
 * *map*: an optional coordinate mapping function.
-* *cache*: the maximum number of cached compiled expressions.
+* *cache*: the maximum number of compiled expressions kept between
+  frames. By default, expressions are only cached until the image is
+  saved.
 */
 
 void view (float tx = 0., float ty = 0.,
@@ -198,8 +201,8 @@ void view (float tx = 0., float ty = 0.,
   }
 
   if (cache > 0) {
-    v->cache = calloc (1, sizeof (cexpr));
     v->maxlen = cache;
+    v->persistent = true;
   }
   
   clear();
@@ -384,6 +387,110 @@ macro2 foreach_visible_plane (bview * view, coord n1, double alpha1)
 }
 #endif // dimension == 3
 
+/**
+## Caching geometries
+
+Generating the geometry (i.e. traversing the mesh, reconstructing
+facets, interpolating colors etc.) is usually much more expensive
+than rendering it. Since the geometries generated above do not
+depend on the camera position (unless only visible vertices are
+traversed, see [vertexbuffer.h]()), the OpenGL commands can be
+recorded the first time they are generated and replayed when the same
+geometry is drawn again, for example when drawing the same timestep
+from several viewpoints.
+
+The key of a geometry combines the parameters of the drawing
+function, given by *format*, with the stamps of all the fields (see
+[stencils.h](grid/stencils.h)), the stamp of the mesh, the domain size
+and the view parameters used by the traversal functions above. Note
+that fields modified outside of *foreach()* loops are not detected.
+
+The cache can be disabled by setting *maxgeometry* to zero (see
+[view.h](view.h#a-cache-of-geometries)). */
+
+static char * geometry_key (bview * view, const char * format, ...)
+{
+  if (view->maxgeometry <= 0 || VertexBuffer.index || VertexBuffer.visible)
+    return NULL;
+  unsigned long stamp = 14695981039346656037UL;
+  for (scalar s in all) {
+    stamp = (stamp ^ s.i)*1099511628211UL;
+    stamp = (stamp ^ s.stamp)*1099511628211UL;
+  }
+  char key[1024];
+  int len = snprintf (key, sizeof(key),
+		      "%lx %ld %ld %d %g %g %g %g %lx %d %d %d ",
+		      stamp, geometry_mesh_stamp(), grid->n, grid->depth,
+		      L0, X0, Y0, Z0, (long) view->map,
+		      view->reversed, view->gfsview, view->maxlevel);
+  va_list ap;
+  va_start (ap, format);
+  len += vsnprintf (key + len, sizeof(key) - len, format, ap);
+  va_end (ap);
+  return len < sizeof(key) ? strdup (key) : NULL;
+}
+
+/**
+If the geometry is in the cache of all the processes, it is
+replayed. */
+
+static bool geometry_replay (bview * view, const char * key)
+{
+  Geometry * g = key ? get_geometry (view->geometry, key) : NULL;
+#if _MPI
+  int found = (g != NULL);
+  mpi_all_reduce (found, MPI_INT, MPI_MIN);
+  if (!found)
+    g = NULL;
+#endif
+  if (!g)
+    return false;
+  vertex_buffer_replay (g->ops, g->values);
+  view->ni += g->ni;
+  return true;
+}
+
+static bool geometry_record (bview * view, const char * key)
+{
+  if (!key || VertexBuffer.ops)
+    return false;
+  VertexBuffer.ops = array_new();
+  VertexBuffer.values = array_new();
+  VertexBuffer.maxrecord = view->maxgeometry;
+  return true;
+}
+
+static void geometry_store (bview * view, char * key, int ni)
+{
+  if (VertexBuffer.ops) { // the recording did not overflow
+    Geometry g = {strdup (key), VertexBuffer.ops, VertexBuffer.values, ni};
+    view->geometry = add_geometry (view->geometry, view->maxgeometry, g);
+    VertexBuffer.ops = VertexBuffer.values = NULL;
+  }
+}
+
+/**
+The geometry generated by the block of code following
+*cached_geometry()* is replayed from the cache, if it is available,
+or recorded and stored in the cache. The *key* is allocated by
+*geometry_key()* (and may be NULL, in which case the geometry is not
+cached). */
+
+macro cached_geometry (bview * view, char * key)
+{
+  {
+    char * _key = key;
+    if (!geometry_replay (view, _key)) {
+      int _ni = view->ni;
+      bool _record = geometry_record (view, _key);
+      {...}
+      if (_record)
+	geometry_store (view, _key, view->ni - _ni);
+    }
+    free (_key);
+  }
+}
+
 macro draw_lines (bview * view, float color[3], float lw)
 {
   {
@@ -406,61 +513,6 @@ static inline double interp (Point point, coord p, scalar col) {
 			     x + p.x*Delta, y + p.y*Delta, z + p.z*Delta);
 }
 
-static double evaluate_expression (Point point, Node * n)
-{
-  assert (n);
-  switch (n->type) {
-  case '1': return n->d.value;
-  case '+': return (evaluate_expression (point, n->e[0]) +
-		    evaluate_expression(point, n->e[1]));
-  case '-': return (evaluate_expression (point, n->e[0]) -
-		    evaluate_expression(point, n->e[1]));
-  case '*': return (evaluate_expression (point, n->e[0]) *
-		    evaluate_expression(point, n->e[1]));
-  case '/': return (evaluate_expression (point, n->e[0]) /
-		    evaluate_expression(point, n->e[1]));
-  case '^': return pow (evaluate_expression (point, n->e[0]),
-			evaluate_expression(point, n->e[1]));
-  case '>': return (evaluate_expression (point, n->e[0]) >
-		    evaluate_expression(point, n->e[1]));
-  case '<': return (evaluate_expression (point, n->e[0]) <
-		    evaluate_expression(point, n->e[1]));
-  case 'L': return (evaluate_expression (point, n->e[0]) <=
-		    evaluate_expression(point, n->e[1]));
-  case 'G': return (evaluate_expression (point, n->e[0]) >=
-		    evaluate_expression(point, n->e[1]));
-  case '=': return (evaluate_expression (point, n->e[0]) ==
-		    evaluate_expression(point, n->e[1]));
-  case 'i': return (evaluate_expression (point, n->e[0]) !=
-		    evaluate_expression(point, n->e[1]));
-  case 'O': return (evaluate_expression (point, n->e[0]) ||
-		    evaluate_expression(point, n->e[1]));
-  case 'A': return (evaluate_expression (point, n->e[0]) &&
-		    evaluate_expression(point, n->e[1]));
-  case '?': return (evaluate_expression (point, n->e[0]) ?
-		    evaluate_expression(point, n->e[1]) :
-		    evaluate_expression(point, n->e[2]));
-  case 'm': return - evaluate_expression (point, n->e[0]);
-  case 'f': return n->d.func (evaluate_expression (point, n->e[0]));
-  case 'v': {
-    scalar s = {n->s};
-    int k[3] = {0,0,0};
-    for (int i = 0; i < 3; i++)
-      if (n->e[i])
-	k[i] = evaluate_expression (point, n->e[i]);
-    return s[k[0],k[1],k[2]];
-  }
-  case 'D': return Delta;
-  case 'x': return x;
-  case 'y': return y;
-  case 'z': return z;
-  default:
-    fprintf (stderr, "unknown operation type '%c'\n", n->type);
-    assert (false);
-  }
-  return undefined;
-}
-
 static bool assemble_node (Node * n)
 {
   if (n->type == 'v') {
@@ -508,6 +560,258 @@ static bool assemble_node (Node * n)
   return true;
 }
 
+/**
+## Compiling expressions
+
+Expressions are compiled into a flat list of instructions operating
+on an array of registers. Identical subexpressions are only evaluated
+once and, as in C, the logical and ternary operators do not evaluate
+the operands they do not need. */
+
+typedef struct {
+  char op;         // the operation (as in Node, see gl/parser.h)
+  int r, a, b, c;  // the result and operand registers
+  union {
+    double value;
+    double (* func) (double);
+    int s;
+  } d;
+} Instruction;
+
+struct _Program {
+  int nregisters, result;
+  Instruction * code; // stored after the structure itself
+};
+
+typedef struct _Program Program;
+
+typedef struct {
+  Array * code;     // the instructions
+  Array * reusable; // the indices of instructions which can be reused
+  int nregisters;
+} Compiler;
+
+static bool same_instruction (const Instruction * i, const Instruction * j)
+{
+  if (i->op != j->op || i->a != j->a || i->b != j->b || i->c != j->c)
+    return false;
+  switch (i->op) {
+  case '1': return i->d.value == j->d.value;
+  case 'f': return i->d.func == j->d.func;
+  case 'v': case 'V': return i->d.s == j->d.s;
+  }
+  return true;
+}
+
+static int emit_instruction (Compiler * c, Instruction i)
+{
+  Instruction * code = c->code->p;
+  int * reusable = c->reusable->p;
+  for (int k = 0; k < c->reusable->len/sizeof(int); k++)
+    if (same_instruction (&code[reusable[k]], &i))
+      return code[reusable[k]].r;
+  i.r = c->nregisters++;
+  int index = c->code->len/sizeof(Instruction);
+  array_append (c->code, &i, sizeof(Instruction));
+  array_append (c->reusable, &index, sizeof(int));
+  return i.r;
+}
+
+/**
+Jumps and copies are never reused. They return the index of the
+instruction. */
+
+static int emit_jump (Compiler * c, char op, int r, int a)
+{
+  Instruction i = {op, r, a, -1};
+  array_append (c->code, &i, sizeof(Instruction));
+  return c->code->len/sizeof(Instruction) - 1;
+}
+
+static void jump_here (Compiler * c, int jump)
+{
+  ((Instruction *)c->code->p)[jump].b = c->code->len/sizeof(Instruction);
+}
+
+static int compile_node (Compiler * c, Node * n)
+{
+  switch (n->type) {
+    
+  case '1':
+    return emit_instruction (c, (Instruction){'1', .d.value = n->d.value});
+    
+  case '+': case '-': case '*': case '/': case '^':
+  case '>': case '<': case 'L': case 'G': case '=': case 'i': {
+    int a = compile_node (c, n->e[0]), b = compile_node (c, n->e[1]);
+    return emit_instruction (c, (Instruction){n->type, 0, a, b});
+  }
+    
+  case 'm':
+    return emit_instruction (c, (Instruction){'m', 0,
+					       compile_node (c, n->e[0])});
+  case 'f':
+    return emit_instruction (c, (Instruction){'f', 0,
+					       compile_node (c, n->e[0]),
+					       .d.func = n->d.func});
+
+  /**
+  Stencil offsets are stored directly in the instruction when they
+  are constant. */
+    
+  case 'v': {
+    bool constant = true;
+    for (int i = 0; i < 3; i++)
+      if (n->e[i] && n->e[i]->type != '1')
+	constant = false;
+    int k[3];
+    for (int i = 0; i < 3; i++)
+      k[i] = !n->e[i] ? (constant ? 0 : -1) :
+	constant ? (int) n->e[i]->d.value : compile_node (c, n->e[i]);
+    return emit_instruction (c, (Instruction){constant ? 'v' : 'V', 0,
+					       k[0], k[1], k[2],
+					       .d.s = n->s});
+  }
+    
+  case 'D': case 'x': case 'y': case 'z':
+    return emit_instruction (c, (Instruction){n->type});
+
+  /**
+  Instructions generated within the conditional branches cannot be
+  reused outside of them. */
+    
+  case 'A': case 'O': {
+    int r = c->nregisters++;
+    emit_jump (c, 'b', r, compile_node (c, n->e[0]));
+    int jump = emit_jump (c, n->type == 'A' ? 'j' : 'k', -1, r);
+    long len = c->reusable->len;
+    emit_jump (c, 'b', r, compile_node (c, n->e[1]));
+    c->reusable->len = len;
+    jump_here (c, jump);
+    return r;
+  }
+
+  case '?': {
+    int r = c->nregisters++;
+    int jump = emit_jump (c, 'j', -1, compile_node (c, n->e[0]));
+    long len = c->reusable->len;
+    emit_jump (c, 'c', r, compile_node (c, n->e[1]));
+    c->reusable->len = len;
+    int end = emit_jump (c, 'J', -1, -1);
+    jump_here (c, jump);
+    emit_jump (c, 'c', r, compile_node (c, n->e[2]));
+    c->reusable->len = len;
+    jump_here (c, end);
+    return r;
+  }
+    
+  default:
+    fprintf (stderr, "unknown operation type '%c'\n", n->type);
+    assert (false);
+  }
+  return -1;
+}
+
+static Program * compile_program (Node * n)
+{
+  Compiler c = {array_new(), array_new(), 0};
+  int result = compile_node (&c, n);
+  Instruction end = {0};
+  array_append (c.code, &end, sizeof(Instruction));
+  Program * p = malloc (sizeof(Program) + c.code->len);
+  p->nregisters = c.nregisters, p->result = result;
+  p->code = (Instruction *) (p + 1);
+  memcpy (p->code, c.code->p, c.code->len);
+  array_free (c.code);
+  array_free (c.reusable);
+  return p;
+}
+
+static double run_program (Point point, const Program * p, double * r)
+{
+  for (const Instruction * i = p->code; i->op; i++)
+    switch (i->op) {
+    case '1': r[i->r] = i->d.value; break;
+    case '+': r[i->r] = r[i->a] + r[i->b]; break;
+    case '-': r[i->r] = r[i->a] - r[i->b]; break;
+    case '*': r[i->r] = r[i->a] * r[i->b]; break;
+    case '/': r[i->r] = r[i->a] / r[i->b]; break;
+    case '^': r[i->r] = pow (r[i->a], r[i->b]); break;
+    case '>': r[i->r] = r[i->a] > r[i->b]; break;
+    case '<': r[i->r] = r[i->a] < r[i->b]; break;
+    case 'L': r[i->r] = r[i->a] <= r[i->b]; break;
+    case 'G': r[i->r] = r[i->a] >= r[i->b]; break;
+    case '=': r[i->r] = r[i->a] == r[i->b]; break;
+    case 'i': r[i->r] = r[i->a] != r[i->b]; break;
+    case 'm': r[i->r] = - r[i->a]; break;
+    case 'f': r[i->r] = i->d.func (r[i->a]); break;
+    case 'v': {
+      scalar s = {i->d.s};
+      r[i->r] = s[i->a, i->b, i->c];
+      break;
+    }
+    case 'V': {
+      scalar s = {i->d.s};
+      int o[3] = {i->a < 0 ? 0 : r[i->a],
+		  i->b < 0 ? 0 : r[i->b],
+		  i->c < 0 ? 0 : r[i->c]};
+      r[i->r] = s[o[0],o[1],o[2]];
+      break;
+    }
+    case 'D': r[i->r] = Delta; break;
+    case 'x': r[i->r] = x; break;
+    case 'y': r[i->r] = y; break;
+    case 'z': r[i->r] = z; break;
+    case 'b': r[i->r] = (r[i->a] != 0.); break;
+    case 'c': r[i->r] = r[i->a]; break;
+    case 'j': if (!r[i->a]) i = p->code + i->b - 1; break;
+    case 'k': if (r[i->a]) i = p->code + i->b - 1; break;
+    case 'J': i = p->code + i->b - 1; break;
+    default: assert (false);
+    }
+  return r[p->result];
+}
+
+/**
+The program is evaluated for each cell. Since the fields it reads
+(and the corresponding stencils) are only known at runtime, their
+boundary conditions are applied beforehand. */
+
+static void evaluate_program (const Program * p, scalar s)
+{
+  scalar * list = NULL;
+  for (const Instruction * i = p->code; i->op; i++)
+    if (i->op == 'v' || i->op == 'V')
+      list = list_add (list, (scalar){i->d.s});
+  boundary (list);
+  free (list);
+  foreach (noauto) {
+    double r[p->nregisters];
+    s[] = run_program (point, p, r);
+  }
+  s.dirty = true, s.stamp++;
+  restriction ({s});
+}
+
+/**
+The stamp of a program combines the stamps of the fields it reads,
+the stamp of the mesh and the domain size. */
+
+static unsigned long program_stamp (const Program * p)
+{
+  unsigned long stamp = 14695981039346656037UL;
+  for (const Instruction * i = p->code; i->op; i++)
+    if (i->op == 'v' || i->op == 'V') {
+      scalar s = {i->d.s};
+      stamp = (stamp ^ s.i)*1099511628211UL;
+      stamp = (stamp ^ s.stamp)*1099511628211UL;
+    }
+  double domain[4] = {L0, X0, Y0, Z0};
+  unsigned char * b = (unsigned char *) domain;
+  for (int i = 0; i < sizeof(domain); i++)
+    stamp = (stamp ^ b[i])*1099511628211UL;
+  return (stamp ^ geometry_mesh_stamp())*1099511628211UL;
+}
+
 static scalar compile_expression (char * expr, bool * isexpr)
 {
   *isexpr = false;
@@ -515,9 +819,15 @@ static scalar compile_expression (char * expr, bool * isexpr)
     return (scalar){-1};
   
   bview * view = get_view();
-  scalar s;
-  if (view->cache && (s = get_cexpr (view->cache, expr)).i >= 0)
-    return s;
+  cexpr * c;
+  if (view->cache && (c = get_cexpr (view->cache, expr))) {
+    unsigned long stamp = program_stamp (c->program);
+    if (stamp != c->stamp) { // the inputs have changed
+      evaluate_program (c->program, c->s);
+      c->stamp = stamp;
+    }
+    return c->s;
+  }
   
   Node * node = parse_node (expr);
   if (node == NULL) {
@@ -535,18 +845,22 @@ static scalar compile_expression (char * expr, bool * isexpr)
       return s;
     }
   }
-  s = new scalar;
+  Program * p = compile_program (node);
+  free_node (node);
+  
+  scalar s = new scalar;
   free (s.name);
   s.name = strdup (expr);
-  foreach()
-    s[] = evaluate_expression (point, node);
-  restriction ({s});
-  free_node (node);
+  s.nodump = true;
+  unsigned long stamp = program_stamp (p);
+  evaluate_program (p, s);
   
   if (view->cache)
-    view->cache = add_cexpr (view->cache, view->maxlen, expr, s);
-  else
+    view->cache = add_cexpr (view->cache, view->maxlen, expr, s, p, stamp);
+  else {
+    free (p);
     *isexpr = true;
+  }
   return s;
 }
 
@@ -914,6 +1228,10 @@ bool draw_vof (char * c, char * s = NULL, bool edges = false,
   
   double cmin = 1e-3; // do not reconstruct fragments smaller than this
 
+  // use the cached interface geometry, if it is valid
+  scalar g = fs.x.i < 0 && interface_geometry_valid (d) ?
+    d.geometry : (scalar){-1};
+
 #if TREE
   // make sure we prolongate properly
   void (* prolongation) (Point, scalar) = d.prolongation;
@@ -924,129 +1242,138 @@ bool draw_vof (char * c, char * s = NULL, bool edges = false,
 #endif // TREE
     
   bview * view = draw();
+  char * key = geometry_key (view, "draw_vof %s %s %d %g %d %s %g %g %d %lx "
+			     "%g %g %g", c, s ? s : "", edges, larger, filled,
+			     color ? color : "", min, max, linear,
+			     (long)(linear && col.i >= 0 ? NULL : map),
+			     fc[0], fc[1], fc[2]);
 #if dimension == 2
-  if (filled) {
-    glColor3f (fc[0], fc[1], fc[2]);
-    glNormal3d (0, 0, view->reversed ? -1 : 1);
-    foreach_visible (view) {
-      if ((filled > 0 && d[] >= 1.) || (filled < 0 && d[] <= 0.)) {
-	glBegin (GL_QUADS);
-	glvertex2d (view, x - Delta_x/2., y - Delta_y/2.);
-	glvertex2d (view, x + Delta_x/2., y - Delta_y/2.);
-	glvertex2d (view, x + Delta_x/2., y + Delta_y/2.);
-	glvertex2d (view, x - Delta_x/2., y + Delta_y/2.);
-	glEnd();
-	view->ni++;
-      }
-      else if (d[] > 0. && d[] < 1.) {
-	coord n = facet_normal (point, d, fs), r = {1.,1.};
-	if (filled < 0)
+  if (filled)
+    cached_geometry (view, key) {
+      glColor3f (fc[0], fc[1], fc[2]);
+      glNormal3d (0, 0, view->reversed ? -1 : 1);
+      foreach_visible (view) {
+	if ((filled > 0 && d[] >= 1.) || (filled < 0 && d[] <= 0.)) {
+	  glBegin (GL_QUADS);
+	  glvertex2d (view, x - Delta_x/2., y - Delta_y/2.);
+	  glvertex2d (view, x + Delta_x/2., y - Delta_y/2.);
+	  glvertex2d (view, x + Delta_x/2., y + Delta_y/2.);
+	  glvertex2d (view, x - Delta_x/2., y + Delta_y/2.);
+	  glEnd();
+	  view->ni++;
+	}
+	else if (d[] > 0. && d[] < 1.) {
+	  coord n = facet_normal (point, d, fs), r = {1.,1.};
+	  if (filled < 0)
+	    foreach_dimension()
+	      n.x = - n.x;
+	  double alpha = plane_alpha (filled < 0. ? 1. - d[] : d[], n);
+	  alpha += (n.x + n.y)/2.;
 	  foreach_dimension()
-	    n.x = - n.x;
-	double alpha = plane_alpha (filled < 0. ? 1. - d[] : d[], n);
-	alpha += (n.x + n.y)/2.;
-	foreach_dimension()
-	  if (n.x < 0.) alpha -= n.x, n.x = - n.x, r.x = - 1.;
-	coord v[5];
-	int nv = 0;
-	if (alpha >= 0. && alpha <= n.x) {
-	  v[nv].x = alpha/n.x, v[nv++].y = 0.;
-	  if (alpha <= n.y)
-	    v[nv].x = 0., v[nv++].y = alpha/n.y;
-	  else if (alpha >= n.y && alpha - n.y <= n.x) {
-	    v[nv].x = (alpha - n.y)/n.x, v[nv++].y = 1.;
-	    v[nv].x = 0., v[nv++].y = 1.;
+	    if (n.x < 0.) alpha -= n.x, n.x = - n.x, r.x = - 1.;
+	  coord v[5];
+	  int nv = 0;
+	  if (alpha >= 0. && alpha <= n.x) {
+	    v[nv].x = alpha/n.x, v[nv++].y = 0.;
+	    if (alpha <= n.y)
+	      v[nv].x = 0., v[nv++].y = alpha/n.y;
+	    else if (alpha >= n.y && alpha - n.y <= n.x) {
+	      v[nv].x = (alpha - n.y)/n.x, v[nv++].y = 1.;
+	      v[nv].x = 0., v[nv++].y = 1.;
+	    }
+	    v[nv].x = 0., v[nv++].y = 0.;
 	  }
-	  v[nv].x = 0., v[nv++].y = 0.;
-	}
-	else if (alpha >= n.x && alpha - n.x <= n.y) {
-	  v[nv].x = 1., v[nv++].y = (alpha - n.x)/n.y;
-	  if (alpha >= n.y && alpha - n.y <= n.x) {
-	    v[nv].x = (alpha - n.y)/n.x, v[nv++].y = 1.;
-	    v[nv].x = 0., v[nv++].y = 1.;
+	  else if (alpha >= n.x && alpha - n.x <= n.y) {
+	    v[nv].x = 1., v[nv++].y = (alpha - n.x)/n.y;
+	    if (alpha >= n.y && alpha - n.y <= n.x) {
+	      v[nv].x = (alpha - n.y)/n.x, v[nv++].y = 1.;
+	      v[nv].x = 0., v[nv++].y = 1.;
+	    }
+	    else if (alpha <= n.y)
+	      v[nv].x = 0., v[nv++].y = alpha/n.y;
+	    v[nv].x = 0., v[nv++].y = 0.;
+	    v[nv].x = 1., v[nv++].y = 0.;
 	  }
-	  else if (alpha <= n.y)
-	    v[nv].x = 0., v[nv++].y = alpha/n.y;
-	  v[nv].x = 0., v[nv++].y = 0.;
-	  v[nv].x = 1., v[nv++].y = 0.;
+	  glBegin (GL_POLYGON);
+	  if (r.x*r.y < 0.)
+	    for (int i = nv - 1; i >= 0; i--)
+	      glvertex2d (view, x + r.x*(v[i].x - 0.5)*Delta,
+			  y + r.y*(v[i].y - 0.5)*Delta);
+	  else
+	    for (int i = 0; i < nv; i++)
+	      glvertex2d (view, x + r.x*(v[i].x - 0.5)*Delta,
+			  y + r.y*(v[i].y - 0.5)*Delta);
+	  glEnd ();
+	  view->ni++;
 	}
-	glBegin (GL_POLYGON);
-	if (r.x*r.y < 0.)
-	  for (int i = nv - 1; i >= 0; i--)
-	    glvertex2d (view, x + r.x*(v[i].x - 0.5)*Delta,
-			y + r.y*(v[i].y - 0.5)*Delta);
-	else
-	  for (int i = 0; i < nv; i++)
-	    glvertex2d (view, x + r.x*(v[i].x - 0.5)*Delta,
-			y + r.y*(v[i].y - 0.5)*Delta);
-	glEnd ();
-	view->ni++;
       }
     }
-  }
   else // !filled
-    draw_lines (view, lc, lw) {
-      glBegin (GL_LINES);
-      foreach_visible (view)
-	if (cfilter (point, d, cmin)) {
-	  coord n = facet_normal (point, d, fs);
-	  double alpha = plane_alpha (d[], n);
-	  coord segment[2];
-	  if (facets (n, alpha, segment) == 2) {
-	    glvertex2d (view, x + segment[0].x*Delta, y + segment[0].y*Delta);
-	    glvertex2d (view, x + segment[1].x*Delta, y + segment[1].y*Delta);
-	    view->ni++;
+    draw_lines (view, lc, lw)
+      cached_geometry (view, key) {
+	glBegin (GL_LINES);
+	foreach_visible (view)
+	  if (cfilter (point, d, cmin)) {
+	    double alpha;
+	    coord n = facet_geometry (point, d, fs, g, &alpha);
+	    coord segment[2];
+	    if (facets (n, alpha, segment) == 2) {
+	      glvertex2d (view, x + segment[0].x*Delta, y + segment[0].y*Delta);
+	      glvertex2d (view, x + segment[1].x*Delta, y + segment[1].y*Delta);
+	      view->ni++;
+	    }
 	  }
-	}
-      glEnd ();
-    }
+	glEnd ();
+      }
 #else // dimension == 3
   if (!larger)
     larger = edges || (color && !linear) ? 1. : 1.1;
   if (edges)
-    draw_lines (view, lc, lw) {
-      foreach_visible (view)
-	if (cfilter (point, d, cmin)) {
-	  coord n = facet_normal (point, d, fs);
-	  double alpha = plane_alpha (d[], n);
-	  coord v[12];
-	  int m = facets (n, alpha, v, larger);
-	  if (m > 2) {
-	    glBegin (GL_LINE_LOOP);
-	    for (int i = 0; i < m; i++)
-	      glvertex3d (view,
-			  x + v[i].x*Delta, y + v[i].y*Delta, z + v[i].z*Delta);
-	    glEnd ();
-	    view->ni++;
+    draw_lines (view, lc, lw)
+      cached_geometry (view, key) {
+	foreach_visible (view)
+	  if (cfilter (point, d, cmin)) {
+	    double alpha;
+	    coord n = facet_geometry (point, d, fs, g, &alpha);
+	    coord v[12];
+	    int m = facets (n, alpha, v, larger);
+	    if (m > 2) {
+	      glBegin (GL_LINE_LOOP);
+	      for (int i = 0; i < m; i++)
+		glvertex3d (view,
+			    x + v[i].x*Delta, y + v[i].y*Delta, z + v[i].z*Delta);
+	      glEnd ();
+	      view->ni++;
+	    }
 	  }
-	}
-    }
+      }
   else // !edges
-    colorize() {
-      foreach_visible (view)
-	if (cfilter (point, d, cmin)) {
-	  coord n = facet_normal (point, d, fs);
-	  double alpha = plane_alpha (d[], n);
-	  coord v[12];
-	  int m = facets (n, alpha, v, larger);
-	  if (m > 2) {
-	    glBegin (GL_POLYGON);
-	    for (int i = 0; i < m; i++) {
-	      if (linear) {
-		color_vertex (interp (point, v[i], col));
-	      }
-	      else {
-		color_facet();
+    colorize()
+      cached_geometry (view, key) {
+	foreach_visible (view)
+	  if (cfilter (point, d, cmin)) {
+	    double alpha;
+	    coord n = facet_geometry (point, d, fs, g, &alpha);
+	    coord v[12];
+	    int m = facets (n, alpha, v, larger);
+	    if (m > 2) {
+	      glBegin (GL_POLYGON);
+	      for (int i = 0; i < m; i++) {
+		if (linear) {
+		  color_vertex (interp (point, v[i], col));
+		}
+		else {
+		  color_facet();
+		}
+		glnormal3d (view, n.x, n.y, n.z);
+		glvertex3d (view,
+			    x + v[i].x*Delta, y + v[i].y*Delta, z + v[i].z*Delta);
 	      }
-	      glnormal3d (view, n.x, n.y, n.z);
-	      glvertex3d (view,
-			  x + v[i].x*Delta, y + v[i].y*Delta, z + v[i].z*Delta);
+	      glEnd ();
+	      view->ni++;
 	    }
-	    glEnd ();
-	    view->ni++;
 	  }
-	}
-    }
+      }
 #endif // dimension == 3
 
 #if TREE
@@ -1132,31 +1459,33 @@ bool cells (coord n = {0,0,1}, double alpha = 0.,
 	    float lc[3] = {0}, float lw = 1.)
 {
   bview * view = draw();
-  draw_lines (view, lc, lw) {
+  char * key = geometry_key (view, "cells %g %g %g %g", n.x, n.y, n.z, alpha);
+  draw_lines (view, lc, lw)
+    cached_geometry (view, key) {
 #if dimension == 2
-    foreach_visible (view) {
-      glBegin (GL_LINE_LOOP);
-      glvertex2d (view, x - Delta_x/2., y - Delta_y/2.);
-      glvertex2d (view, x + Delta_x/2., y - Delta_y/2.);
-      glvertex2d (view, x + Delta_x/2., y + Delta_y/2.);
-      glvertex2d (view, x - Delta_x/2., y + Delta_y/2.);
-      glEnd();
-      view->ni++;
-    }
-#else // dimension == 3
-    foreach_visible_plane (view, n, alpha) {
-      coord v[12];
-      int m = facets (n, alpha, v, 1.);
-      if (m > 2) {
+      foreach_visible (view) {
 	glBegin (GL_LINE_LOOP);
-	for (int i = 0; i < m; i++)
-	  glvertex3d (view, x + v[i].x*Delta, y + v[i].y*Delta, z + v[i].z*Delta);
-	glEnd ();
+	glvertex2d (view, x - Delta_x/2., y - Delta_y/2.);
+	glvertex2d (view, x + Delta_x/2., y - Delta_y/2.);
+	glvertex2d (view, x + Delta_x/2., y + Delta_y/2.);
+	glvertex2d (view, x - Delta_x/2., y + Delta_y/2.);
+	glEnd();
 	view->ni++;
       }
-    }
+#else // dimension == 3
+      foreach_visible_plane (view, n, alpha) {
+	coord v[12];
+	int m = facets (n, alpha, v, 1.);
+	if (m > 2) {
+	  glBegin (GL_LINE_LOOP);
+	  for (int i = 0; i < m; i++)
+	    glvertex3d (view, x + v[i].x*Delta, y + v[i].y*Delta, z + v[i].z*Delta);
+	  glEnd ();
+	  view->ni++;
+	}
+      }
 #endif // dimension == 3
-  }
+    }
   return true;
 }
 
@@ -1261,122 +1590,128 @@ bool squares (char * color,
   colorize_args();
   scalar f = col;
   bview * view = draw();
+  char * key = geometry_key (view, "squares %s %s %g %g %d %lx %g %g %g %g",
+			     color, z ? z : "", min, max, linear,
+			     (long)(linear ? NULL : map),
+			     n.x, n.y, n.z, alpha);
   glShadeModel (GL_SMOOTH);
   if (linear) {
-    colorize() {
+    colorize()
+      cached_geometry (view, key) {
 #if dimension == 2
-      if (Z.i < 0) {
-	glNormal3d (0, 0, view->reversed ? -1 : 1);
-	foreach_visible (view)
+	if (Z.i < 0) {
+	  glNormal3d (0, 0, view->reversed ? -1 : 1);
+	  foreach_visible (view)
+	    if (f.i < 0 || f[] != nodata) {
+	      glBegin (GL_TRIANGLE_FAN);
+	      color_vertex ((4.*f[] +
+			     2.*(f[1] + f[-1] + f[0,1] + f[0,-1]) +
+			     f[-1,-1] + f[1,1] + f[-1,1] + f[1,-1])/16.);
+	      glvertex2d (view, x, y);
+	      color_vertex ((f[] + f[-1] + f[-1,-1] + f[0,-1])/4.);
+	      glvertex2d (view, x - Delta_x/2., y - Delta_y/2.);
+	      color_vertex ((f[] + f[1] + f[1,-1] + f[0,-1])/4.);
+	      glvertex2d (view, x + Delta_x/2., y - Delta_y/2.);
+	      color_vertex ((f[] + f[1] + f[1,1] + f[0,1])/4.);
+	      glvertex2d (view, x + Delta_x/2., y + Delta_y/2.);
+	      color_vertex ((f[] + f[-1] + f[-1,1] + f[0,1])/4.);
+	      glvertex2d (view, x - Delta_x/2., y + Delta_y/2.);
+	      color_vertex ((f[] + f[-1] + f[-1,-1] + f[0,-1])/4.);
+	      glvertex2d (view, x - Delta_x/2., y - Delta_y/2.);
+	      glEnd();
+	      view->ni++;
+	    }
+	}
+	else // Z.i > 0
+	  foreach_leaf() // fixme: foreach_visible() would be better
+	    if (f.i < 0 || f[] != nodata) {
+	      glBegin (GL_TRIANGLE_FAN);
+	      color_vertex ((4.*f[] +
+			     2.*(f[1] + f[-1] + f[0,1] + f[0,-1]) +
+			     f[-1,-1] + f[1,1] + f[-1,1] + f[1,-1])/16.);
+	      glvertex_normal3d (view, point, fn, x, y, Z[]);
+	      color_vertex ((f[] + f[-1] + f[-1,-1] + f[0,-1])/4.);
+	      glvertex_normal3d (view, point, fn, x - Delta_x/2., y - Delta_y/2.,
+				 (Z[] + Z[-1] + Z[-1,-1] + Z[0,-1])/4.);
+	      color_vertex ((f[] + f[1] + f[1,-1] + f[0,-1])/4.);
+	      glvertex_normal3d (view, point, fn, x + Delta_x/2., y - Delta_y/2.,
+				 (Z[] + Z[1] + Z[1,-1] + Z[0,-1])/4.);
+	      color_vertex ((f[] + f[1] + f[1,1] + f[0,1])/4.);
+	      glvertex_normal3d (view, point, fn, x + Delta_x/2., y + Delta_y/2.,
+				 (Z[] + Z[1] + Z[1,1] + Z[0,1])/4.);
+	      color_vertex ((f[] + f[-1] + f[-1,1] + f[0,1])/4.);
+	      glvertex_normal3d (view, point, fn, x - Delta_x/2., y + Delta_y/2.,
+				 (Z[] + Z[-1] + Z[-1,1] + Z[0,1])/4.);
+	      color_vertex ((f[] + f[-1] + f[-1,-1] + f[0,-1])/4.);
+	      glvertex_normal3d (view, point, fn, x - Delta_x/2., y - Delta_y/2.,
+				 (Z[] + Z[-1] + Z[-1,-1] + Z[0,-1])/4.);
+	      glEnd();
+	      view->ni++;	    
+	    }
+#else // dimension == 3
+	foreach_visible_plane (view, n, alpha)
 	  if (f.i < 0 || f[] != nodata) {
-	    glBegin (GL_TRIANGLE_FAN);
-	    color_vertex ((4.*f[] +
-			   2.*(f[1] + f[-1] + f[0,1] + f[0,-1]) +
-			   f[-1,-1] + f[1,1] + f[-1,1] + f[1,-1])/16.);
-	    glvertex2d (view, x, y);
-	    color_vertex ((f[] + f[-1] + f[-1,-1] + f[0,-1])/4.);
-	    glvertex2d (view, x - Delta_x/2., y - Delta_y/2.);
-	    color_vertex ((f[] + f[1] + f[1,-1] + f[0,-1])/4.);
-	    glvertex2d (view, x + Delta_x/2., y - Delta_y/2.);
-	    color_vertex ((f[] + f[1] + f[1,1] + f[0,1])/4.);
-	    glvertex2d (view, x + Delta_x/2., y + Delta_y/2.);
-	    color_vertex ((f[] + f[-1] + f[-1,1] + f[0,1])/4.);
-	    glvertex2d (view, x - Delta_x/2., y + Delta_y/2.);
-	    color_vertex ((f[] + f[-1] + f[-1,-1] + f[0,-1])/4.);
-	    glvertex2d (view, x - Delta_x/2., y - Delta_y/2.);
-	    glEnd();
-	    view->ni++;
+	    coord v[12];
+	    int m = facets (n, alpha, v, 1.);
+	    if (m > 2) {
+	      coord c = {0,0,0};
+	      for (int i = 0; i < m; i++)
+		foreach_dimension()
+		  c.x += v[i].x/m;
+	      glBegin (GL_TRIANGLE_FAN);
+	      color_vertex (interp (point, c, f));
+	      glvertex3d (view, x + c.x*Delta, y + c.y*Delta, z + c.z*Delta);
+	      for (int i = 0; i < m; i++) {
+		color_vertex (interp (point, v[i], f));
+		glvertex3d (view,
+			    x + v[i].x*Delta, y + v[i].y*Delta, z + v[i].z*Delta);
+	      }
+	      color_vertex (interp (point, v[0], f));
+	      glvertex3d (view,
+			  x + v[0].x*Delta, y + v[0].y*Delta, z + v[0].z*Delta);
+	      glEnd ();
+	      view->ni++;
+	    }
 	  }
+#endif // dimension == 3
       }
-      else // Z.i > 0
-	foreach_leaf() // fixme: foreach_visible() would be better
-	  if (f.i < 0 || f[] != nodata) {
-	    glBegin (GL_TRIANGLE_FAN);
-	    color_vertex ((4.*f[] +
-			   2.*(f[1] + f[-1] + f[0,1] + f[0,-1]) +
-			   f[-1,-1] + f[1,1] + f[-1,1] + f[1,-1])/16.);
-	    glvertex_normal3d (view, point, fn, x, y, Z[]);
-	    color_vertex ((f[] + f[-1] + f[-1,-1] + f[0,-1])/4.);
-	    glvertex_normal3d (view, point, fn, x - Delta_x/2., y - Delta_y/2.,
-			       (Z[] + Z[-1] + Z[-1,-1] + Z[0,-1])/4.);
-	    color_vertex ((f[] + f[1] + f[1,-1] + f[0,-1])/4.);
-	    glvertex_normal3d (view, point, fn, x + Delta_x/2., y - Delta_y/2.,
-			       (Z[] + Z[1] + Z[1,-1] + Z[0,-1])/4.);
-	    color_vertex ((f[] + f[1] + f[1,1] + f[0,1])/4.);
-	    glvertex_normal3d (view, point, fn, x + Delta_x/2., y + Delta_y/2.,
-			       (Z[] + Z[1] + Z[1,1] + Z[0,1])/4.);
-	    color_vertex ((f[] + f[-1] + f[-1,1] + f[0,1])/4.);
-	    glvertex_normal3d (view, point, fn, x - Delta_x/2., y + Delta_y/2.,
-			       (Z[] + Z[-1] + Z[-1,1] + Z[0,1])/4.);
-	    color_vertex ((f[] + f[-1] + f[-1,-1] + f[0,-1])/4.);
-	    glvertex_normal3d (view, point, fn, x - Delta_x/2., y - Delta_y/2.,
-			       (Z[] + Z[-1] + Z[-1,-1] + Z[0,-1])/4.);
-	    glEnd();
-	    view->ni++;	    
-	  }
+  }
+  else // !linear
+    cached_geometry (view, key) {
+#if dimension == 2
+      glNormal3d (0, 0, view->reversed ? -1 : 1);
+      glBegin (GL_QUADS);
+      foreach_visible (view)
+	if (f.i < 0 || f[] != nodata) {
+	  color_facet();
+	  glvertex2d (view, x - Delta_x/2., y - Delta_y/2.);
+	  color_facet();
+	  glvertex2d (view, x + Delta_x/2., y - Delta_y/2.);
+	  color_facet();
+	  glvertex2d (view, x + Delta_x/2., y + Delta_y/2.);
+	  color_facet();
+	  glvertex2d (view, x - Delta_x/2., y + Delta_y/2.);
+	  view->ni++;
+	}
+      glEnd();
 #else // dimension == 3
       foreach_visible_plane (view, n, alpha)
 	if (f.i < 0 || f[] != nodata) {
 	  coord v[12];
 	  int m = facets (n, alpha, v, 1.);
 	  if (m > 2) {
-	    coord c = {0,0,0};
-	    for (int i = 0; i < m; i++)
-	      foreach_dimension()
-		c.x += v[i].x/m;
-	    glBegin (GL_TRIANGLE_FAN);
-	    color_vertex (interp (point, c, f));
-	    glvertex3d (view, x + c.x*Delta, y + c.y*Delta, z + c.z*Delta);
+	    glBegin (GL_POLYGON);
 	    for (int i = 0; i < m; i++) {
-	      color_vertex (interp (point, v[i], f));
+	      color_facet();
 	      glvertex3d (view,
 			  x + v[i].x*Delta, y + v[i].y*Delta, z + v[i].z*Delta);
 	    }
-	    color_vertex (interp (point, v[0], f));
-	    glvertex3d (view,
-			x + v[0].x*Delta, y + v[0].y*Delta, z + v[0].z*Delta);
 	    glEnd ();
 	    view->ni++;
 	  }
 	}
 #endif // dimension == 3
     }
-  }
-  else { // !linear
-#if dimension == 2
-    glNormal3d (0, 0, view->reversed ? -1 : 1);
-    glBegin (GL_QUADS);
-    foreach_visible (view)
-      if (f.i < 0 || f[] != nodata) {
-	color_facet();
-	glvertex2d (view, x - Delta_x/2., y - Delta_y/2.);
-	color_facet();
-	glvertex2d (view, x + Delta_x/2., y - Delta_y/2.);
-	color_facet();
-	glvertex2d (view, x + Delta_x/2., y + Delta_y/2.);
-	color_facet();
-	glvertex2d (view, x - Delta_x/2., y + Delta_y/2.);
-	view->ni++;
-      }
-    glEnd();
-#else // dimension == 3
-    foreach_visible_plane (view, n, alpha)
-      if (f.i < 0 || f[] != nodata) {
-	coord v[12];
-	int m = facets (n, alpha, v, 1.);
-	if (m > 2) {
-	  glBegin (GL_POLYGON);
-	  for (int i = 0; i < m; i++) {
-	    color_facet();
-	    glvertex3d (view,
-			x + v[i].x*Delta, y + v[i].y*Delta, z + v[i].z*Delta);
-	  }
-	  glEnd ();
-	  view->ni++;
-	}
-      }
-#endif // dimension == 3
-  }
   if (expr) delete ({col});
 #if dimension == 2
   if (zexpr) delete ({Z});
@@ -1558,47 +1893,51 @@ bool isosurface (char * f,
 
   colorize_args();
 
-  vertex scalar fv[];
-  foreach_vertex()
-    fv[] = (ff[] + ff[-1] + ff[0,-1] + ff[-1,-1] +
-	    ff[0,0,-1] + ff[-1,0,-1] + ff[0,-1,-1] + ff[-1,-1,-1])/8.;
-  
-  vector n[];
-  foreach()
-    foreach_dimension()
-      n.x[] = center_gradient(ff);
-
   bview * view = draw();
+  char * key = geometry_key (view, "isosurface %s %g %s %g %g %d %lx",
+			     f, v, color ? color : "", min, max, linear,
+			     (long)(linear && col.i >= 0 ? NULL : map));
   glShadeModel (GL_SMOOTH);
-  colorize() {
-    foreach_visible (view) {
-      double val[8] = {
-	fv[0,0,0], fv[1,0,0], fv[1,0,1], fv[0,0,1],
-	fv[0,1,0], fv[1,1,0], fv[1,1,1], fv[0,1,1]
-      };
-      double t[5][3][3];
-      int nt = polygonize (val, v, t);
-      for (int i = 0; i < nt; i++) {
-	color_facet();
-	glBegin (GL_POLYGON);
-	for (int j = 0; j < 3; j++) {
-	  coord v = {t[i][j][0], t[i][j][1], t[i][j][2]}, np;
-	  foreach_dimension()
-	    np.x = interp (point, v, n.x);
-	  glnormal3d (view, np.x, np.y, np.z);
-	  if (linear) {
-	    color_vertex (interp (point, v, col));
-	  }
-	  else {
-	    color_facet();
+  colorize()
+    cached_geometry (view, key) {
+      vertex scalar fv[];
+      foreach_vertex()
+	fv[] = (ff[] + ff[-1] + ff[0,-1] + ff[-1,-1] +
+		ff[0,0,-1] + ff[-1,0,-1] + ff[0,-1,-1] + ff[-1,-1,-1])/8.;
+  
+      vector n[];
+      foreach()
+	foreach_dimension()
+	  n.x[] = center_gradient(ff);
+
+      foreach_visible (view) {
+	double val[8] = {
+	  fv[0,0,0], fv[1,0,0], fv[1,0,1], fv[0,0,1],
+	  fv[0,1,0], fv[1,1,0], fv[1,1,1], fv[0,1,1]
+	};
+	double t[5][3][3];
+	int nt = polygonize (val, v, t);
+	for (int i = 0; i < nt; i++) {
+	  color_facet();
+	  glBegin (GL_POLYGON);
+	  for (int j = 0; j < 3; j++) {
+	    coord v = {t[i][j][0], t[i][j][1], t[i][j][2]}, np;
+	    foreach_dimension()
+	      np.x = interp (point, v, n.x);
+	    glnormal3d (view, np.x, np.y, np.z);
+	    if (linear) {
+	      color_vertex (interp (point, v, col));
+	    }
+	    else {
+	      color_facet();
+	    }
+	    glvertex3d (view, x + v.x*Delta_x, y + v.y*Delta_y, z + v.z*Delta_z);
 	  }
-	  glvertex3d (view, x + v.x*Delta_x, y + v.y*Delta_y, z + v.z*Delta_z);
+	  glEnd ();
+	  view->ni++;
 	}
-	glEnd ();
-	view->ni++;
       }
     }
-  }
   if (expr) delete ({col});
   if (fexpr) delete ({ff});
 #endif // dimension > 2
@@ -494,6 +494,176 @@ void reconstruction (const scalar c, vector n, scalar alpha)
 #endif
 }
 
+/**
+### Cached interface geometry
+
+The interface normal and intercept are needed by several solvers and
+outputs (VOF advection, curvature, facets output, interface drawing
+etc.). Rather than reconstructing them independently, these can use
+the geometry cached in the fields attached to the volume fraction
+field `c` through its `geometry` (the intercept) and `geometry_n`
+(the normal) attributes.
+
+The cache is only recomputed if the volume fraction field has been
+modified (as detected using its `stamp` attribute, see
+[stencils.h](grid/stencils.h)) or if the mesh has changed since the
+last reconstruction. Note that the stamp is only incremented by
+`foreach()` (and similar) loops: modifications using `reset()`,
+`foreach_cell()` or direct access to the values are not detected and
+must be followed by an explicit `c.stamp++`. */
+
+attribute {
+  scalar geometry;                    // cached intercept
+  vector geometry_n;                  // cached normal
+  long geometry_stamp, geometry_mesh; // stamps of the cached geometry
+}
+
+static long geometry_mesh_stamp()
+{
+#if TREE
+  update_cache();
+  return tree->stamp;
+#else
+  return 0;
+#endif
+}
+
+static void delete_geometry (scalar c)
+{
+  scalar alpha = c.geometry;
+  if (alpha.i) {
+    vector n = c.geometry_n;
+    delete ({alpha, n});
+    c.geometry.i = 0;
+  }
+}
+
+bool interface_geometry_valid (scalar c)
+{
+  return c.geometry.i && c.geometry_stamp == c.stamp &&
+    c.geometry_mesh == geometry_mesh_stamp();
+}
+
+/**
+This allocates the fields for the intercept and normal of an
+interface. */
+
+static scalar geometry_new (vector * pn)
+{
+  scalar alpha = new scalar;
+  vector n = new vector;
+  alpha.nodump = true;
+  foreach_dimension()
+    n.x.nodump = true;
+#if TREE
+  foreach_dimension()
+    n.x.refine = n.x.prolongation = refine_injection;
+  alpha.n = n;
+  alpha.refine = alpha.prolongation = alpha_refine;
+#endif
+  *pn = n;
+  return alpha;
+}
+
+/**
+This reconstructs the interfaces of a list of volume fractions `cl`
+into the corresponding lists of normals `nl` and intercepts `alphal`,
+within a single traversal of the grid. */
+
+void geometries_reconstruct (scalar * cl, vector * nl, scalar * alphal)
+{
+  foreach() {
+    scalar c, alpha;
+    vector n;
+    for (c, n, alpha in cl, nl, alphal)
+      if (c[] <= 0. || c[] >= 1.) {
+	alpha[] = 0.;
+	foreach_dimension()
+	  n.x[] = 0.;
+      }
+      else {
+	coord m = interface_normal (point, c);
+	foreach_dimension()
+	  n.x[] = m.x;
+	alpha[] = plane_alpha (c[], m);
+      }
+  }
+}
+
+/**
+The geometries of a list of volume fractions are updated together. */
+
+trace
+void interface_geometries (scalar * list)
+{
+  scalar * cl = NULL, * alphal = NULL;
+  vector * nl = NULL;
+  for (scalar c in list)
+    if (!interface_geometry_valid (c)) {
+      if (!c.geometry.i) {
+	vector n;
+	c.geometry = geometry_new (&n), c.geometry_n = n;
+	c.delete = delete_geometry;
+      }
+      cl = list_append (cl, c);
+      alphal = list_append (alphal, c.geometry);
+      nl = vectors_append (nl, c.geometry_n);
+    }
+  if (!cl)
+    return;
+  geometries_reconstruct (cl, nl, alphal);
+  long mesh = geometry_mesh_stamp();
+  for (scalar c in cl)
+    c.geometry_stamp = c.stamp, c.geometry_mesh = mesh;
+  free (cl), free (alphal), free (nl);
+}
+
+/**
+This returns the (updated) intercept field for `c`. The normal is
+`c.geometry_n`. */
+
+scalar interface_geometry (scalar c)
+{
+  interface_geometries ({c});
+  return c.geometry;
+}
+
+/**
+The interface normal and intercept in a cell are then given by the
+function below, which uses the cached geometry `g` (if `g.i >= 0`) in
+leaf cells and reconstructs the interface otherwise. */
+
+coord cached_normal (Point point, scalar c, scalar g, double * alpha)
+{
+  coord n;
+  if (g.i >= 0 && is_leaf(cell)) {
+    vector m = c.geometry_n;
+    foreach_dimension()
+      n.x = m.x[];
+    *alpha = g[];
+  }
+  else {
+    n = interface_normal (point, c);
+    *alpha = plane_alpha (c[], n);
+  }
+  return n;
+}
+
+/**
+The same, but using the surface fractions `s` (if defined) to compute
+the normal, as with [facet_normal()](#facet_normal). */
+
+coord facet_geometry (Point point, scalar c, face vector s, scalar g,
+		      double * alpha)
+{
+  if (s.x.i >= 0) {
+    coord n = facet_normal (point, c, s);
+    *alpha = plane_alpha (c[], n);
+    return n;
+  }
+  return cached_normal (point, c, g, alpha);
+}
+
 /**
 ## Interface output
 
@@ -509,16 +679,18 @@ vector field `s` containing the surface fractions.
 If `s` is specified, the surface fractions are used to compute the
 interface normals which leads to a continuous interface representation
 in most cases. Otherwise the interface normals are approximated from
-the volume fraction field, which results in a piecewise continuous
-(i.e. geometric VOF) interface representation. */
+the volume fraction field (using the [cached
+geometry](#cached-interface-geometry)), which results in a piecewise
+continuous (i.e. geometric VOF) interface representation. */
 
 trace
 void output_facets (scalar c, FILE * fp = stdout, face vector s = {{-1}})
 {
+  scalar g = s.x.i < 0 ? interface_geometry (c) : (scalar){-1};
   foreach (serial)
     if (c[] > 1e-6 && c[] < 1. - 1e-6) {
-      coord n = facet_normal (point, c, s);
-      double alpha = plane_alpha (c[], n);
+      double alpha;
+      coord n = facet_geometry (point, c, s, g, &alpha);
 #if dimension == 1
       fprintf (fp, "%g\n", x + Delta*alpha/n.x);
 #elif dimension == 2
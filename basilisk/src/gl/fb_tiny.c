@@ -9,6 +9,12 @@ The "hardware" for this implementation is the [tiny
 renderer](tinyrenderer/README.md) originally written by Dmitry
 V. Sokolov. 
 
+Primitives are rasterized by [tiles](tinyrenderer/tiny.c#tiles), after
+they have been submitted. The fragment shaders below thus cannot use
+global state which may change in the meantime: this state is either
+copied into the shader data (current color, constant shading) or the
+pending primitives are flushed before it changes (texture, light).
+
 Also this page:
 https://fgiesen.wordpress.com/2013/02/06/the-barycentric-conspirac/
 */
@@ -31,7 +37,10 @@ void glBindTexture (GLenum target, GLuint texture) {
 
 void glDisable (GLenum cap) {}
 void glEnable (GLenum cap) {}
-void glFinish (void) {}
+void glFinish (void) {
+  if (TinyFramebuffer)
+    tiny_flush (TinyFramebuffer);
+}
 void glGetDoublev (GLenum pname, GLdouble * params) {}
 void glHint (GLenum target, GLenum mode) {}
 void glLightModeli (GLenum pname, GLint param) {}
@@ -50,7 +59,10 @@ void glTexImage1D (GLenum target, GLint level, GLint internalFormat,
 {
   assert (target == GL_TEXTURE_1D && level == 0 && internalFormat == GL_RGB &&
 	  width == TEXTURE_WIDTH && border == 0 && format == GL_RGB && type == GL_FLOAT);
-  memcpy (texture, data, 3*TEXTURE_WIDTH*sizeof (float));
+  if (memcmp (texture, data, 3*TEXTURE_WIDTH*sizeof (float))) {
+    glFinish();
+    memcpy (texture, data, 3*TEXTURE_WIDTH*sizeof (float));
+  }
 }
 
 static real modelview0[16] = {
@@ -95,6 +107,17 @@ light_t Light0 = {
 
 static const int not_implemented = 0;
 
+static void light_direction (void)
+{
+  vec3 d = vec3_normalized (vec4_proj3 (mat4_mul (*((mat4 *)modelview), Light0.position)));
+  if (d.x != Light0._VP_inf_norm.x ||
+      d.y != Light0._VP_inf_norm.y ||
+      d.z != Light0._VP_inf_norm.z) {
+    glFinish();
+    Light0._VP_inf_norm = d;
+  }
+}
+
 void glLightfv (GLenum light, GLenum pname, const GLfloat *params)
 {
   assert (light == GL_LIGHT0); // only one light is implemented
@@ -102,7 +125,7 @@ void glLightfv (GLenum light, GLenum pname, const GLfloat *params)
     
   case GL_POSITION:
     Light0.position = (vec4){ params[0], params[1], params[2], params[3] };
-    Light0._VP_inf_norm = vec3_normalized (vec4_proj3 (mat4_mul (*((mat4 *)modelview), Light0.position)));
+    light_direction();
     break;
 
 #if 0 // fixme: does not seem to match with OSMesa when changed from the default (0.2) above   
@@ -114,6 +137,8 @@ void glLightfv (GLenum light, GLenum pname, const GLfloat *params)
     
   case GL_DIFFUSE:
     assert (params[0] == params[1] && params[1] == params[2]); // only white lights are implemented
+    if (params[0] != Light0.diffuse)
+      glFinish();
     Light0.diffuse = params[0];
     break;
     
@@ -153,7 +178,7 @@ void glGetFloatv (GLenum pname, GLfloat * params)
   case GL_MODELVIEW_MATRIX:
     for (int i = 0; i < 16; i++)
       params[i] = modelview[i];
-    Light0._VP_inf_norm = vec3_normalized (vec4_proj3 (mat4_mul (*((mat4 *)modelview), Light0.position)));
+    light_direction();
     break;
     
   case GL_PROJECTION_MATRIX:
@@ -309,6 +334,7 @@ static TinyColor clear = {255,255,255,0};
 void glClear (GLbitfield mask)
 {
   assert (TinyFramebuffer);
+  tiny_flush (TinyFramebuffer);
   if (mask & GL_COLOR_BUFFER_BIT) {
     unsigned char * p = TinyFramebuffer->image;
     for (int i = 0; i < TinyFramebuffer->width*TinyFramebuffer->height; i++, p += 4)
@@ -403,41 +429,61 @@ void shaded_color (const TinyColor * color, float shade, TinyColor * frag_color)
   f[3] = c[3]; // alpha channel
 }
 
+typedef struct {
+  TinyColor color;
+  float shade;
+} ConstantShader;
+
 static
 int constant_normal_shader (const void * data, const vec3 bar, TinyColor * frag_color)
 {
-  const TinyColor * color = data;
-  shaded_color (color, constant_normal_shade, frag_color);
+  const ConstantShader * s = data;
+  shaded_color (&s->color, s->shade, frag_color);
   return 0; // the pixel is not discarded
 }
 
+typedef struct {
+  mat3 colors;
+  float shade;
+} ConstantColorShader;
+
 static
 int constant_normal_color_shader (const void * data, const vec3 bar, TinyColor * frag_color)
 {
-  const mat3 * nc = data;
-  vec3 bc = mat3_mul (mat3_transpose (nc[0]), bar); // per-vertex color interpolation
+  const ConstantColorShader * s = data;
+  vec3 bc = mat3_mul (mat3_transpose (s->colors), bar); // per-vertex color interpolation
   TinyColor color = { bc.x*255, bc.y*255, bc.z*255, 255 };
-  shaded_color (&color, constant_normal_shade, frag_color);
+  shaded_color (&color, s->shade, frag_color);
   return 0; // the pixel is not discarded
 }
 
+typedef struct {
+  vec3 t;
+  float shade;
+} ConstantTextureShader;
+
 static
 int constant_normal_texture_shader (const void * data, const vec3 bar, TinyColor * frag_color)
 {
-  const vec3 * t = data;
-  real bt = vec3_scalar (*t, bar); // per-vertex texture interpolation
+  const ConstantTextureShader * s = data;
+  real bt = vec3_scalar (s->t, bar); // per-vertex texture interpolation
   int i = clamp (bt, 0, 1)*(TEXTURE_WIDTH - 1);
   TinyColor color = { 255*texture[3*i], 255*texture[3*i+1], 255*texture[3*i+2], 255 };
-  shaded_color (&color, constant_normal_shade, frag_color);
+  shaded_color (&color, s->shade, frag_color);
   return 0; // the pixel is not discarded
 }
 
+typedef struct {
+  mat3 normals;
+  TinyColor color;
+} NormalShader;
+
 static
 int vertex_normal_shader (const void * data, const vec3 bar, TinyColor * frag_color)
 {
-  const mat3 * nm = data;
-  vec3 bn = vec3_normalized (mat3_mul (mat3_transpose (nm[0]), bar)); // per-vertex normal interpolation
-  shaded_color (&FgColor, normal_shade (bn), frag_color);
+  const NormalShader * s = data;
+  vec3 bn = vec3_normalized (mat3_mul (mat3_transpose (s->normals), bar)); // per-vertex normal interpolation
+  shaded_color (&s->color, normal_shade (bn), frag_color);
   return 0; // the pixel is not discarded
 }
 
@@ -496,11 +542,12 @@ void glVertex3d (GLdouble x, GLdouble y, GLdouble z)
     if (nvertex == 4) {
       assert (nnormal == 0); // only constant shading is implemented
       assert (ntexture == 0); // textures are not implemented on quads
+      ConstantShader s = { FgColor, constant_normal_shade };
       tiny_triangle ((vec4[3]){vertex[0], vertex[1], vertex[3]},
-		     &FgColor, constant_normal_shader, Face, // fixme: swap NULL and constant_normal_shader
+		     &s, sizeof (s), constant_normal_shader, Face, // fixme: swap NULL and constant_normal_shader
 		     TinyFramebuffer);
       tiny_triangle ((vec4[3]){vertex[1], vertex[2], vertex[3]},
-		     &FgColor, constant_normal_shader, Face,
+		     &s, sizeof (s), constant_normal_shader, Face,
 		     TinyFramebuffer);
       reset_vertices();
     }
@@ -539,19 +586,23 @@ void glEnd (void)
     if (nnormal == 0) {
       if (ntexture == nvertex)
 	for (int i = 1; i < nvertex - 1; i++) {
-	  vec3 t = { texcoord[i], texcoord[i + 1], texcoord[0] };
+	  ConstantTextureShader s = { { texcoord[i], texcoord[i + 1], texcoord[0] },
+				      constant_normal_shade };
 	  tiny_triangle ((vec4[3]){vertex[i], vertex[i + 1], vertex[0]},
-			 &t, constant_normal_texture_shader, Face, TinyFramebuffer);
+			 &s, sizeof (s), constant_normal_texture_shader, Face, TinyFramebuffer);
 	}
-      else if (ncolor == 0)
+      else if (ncolor == 0) {
+	ConstantShader s = { FgColor, constant_normal_shade };
 	for (int i = 1; i < nvertex - 1; i++)
 	  tiny_triangle ((vec4[3]){vertex[i], vertex[i + 1], vertex[0]},
-			 &FgColor, constant_normal_shader, Face, TinyFramebuffer);
+			 &s, sizeof (s), constant_normal_shader, Face, TinyFramebuffer);
+      }
       else if (ncolor == nvertex)
 	for (int i = 1; i < nvertex - 1; i++) {
-	  mat3 mc = { color[i], color[i + 1], color[0] };
+	  ConstantColorShader s = { { color[i], color[i + 1], color[0] },
+				    constant_normal_shade };
 	  tiny_triangle ((vec4[3]){vertex[i], vertex[i + 1], vertex[0]},
-			 &mc, constant_normal_color_shader, Face, TinyFramebuffer);
+			 &s, sizeof (s), constant_normal_color_shader, Face, TinyFramebuffer);
 	}
       else
 	fprintf (stderr, "%s:%d: warning: %d != %d\n", __FILE__, __LINE__, ncolor, nvertex);
@@ -562,20 +613,20 @@ void glEnd (void)
 	  mat3 nm[2] = { { normal[i], normal[i + 1], normal[0] },
 			 { { texcoord[i], texcoord[i + 1], texcoord[0] } } };
 	  tiny_triangle ((vec4[3]){vertex[i], vertex[i + 1], vertex[0]},
-			 nm, vertex_normal_texture_shader, Face, TinyFramebuffer);
+			 nm, sizeof (nm), vertex_normal_texture_shader, Face, TinyFramebuffer);
 	}
       else if (ncolor == 0)
 	for (int i = 1; i < nvertex - 1; i++) {
-	  mat3 nm = { normal[i], normal[i + 1], normal[0] };
+	  NormalShader s = { { normal[i], normal[i + 1], normal[0] }, FgColor };
 	  tiny_triangle ((vec4[3]){vertex[i], vertex[i + 1], vertex[0]},
-			 &nm, vertex_normal_shader, Face, TinyFramebuffer);
+			 &s, sizeof (s), vertex_normal_shader, Face, TinyFramebuffer);
 	}
       else if (ncolor == nvertex)
 	for (int i = 1; i < nvertex - 1; i++) {
 	  mat3 nm[2] = { { normal[i], normal[i + 1], normal[0] },
 			 { color[i],  color[i + 1],  color[0] } };
 	  tiny_triangle ((vec4[3]){vertex[i], vertex[i + 1], vertex[0]},
-			 nm, vertex_normal_color_shader, Face, TinyFramebuffer);
+			 nm, sizeof (nm), vertex_normal_color_shader, Face, TinyFramebuffer);
 	}
       else
 	fprintf (stderr, "%s:%d: warning: %d, %d, %d\n", __FILE__, __LINE__, ntexture, ncolor, nvertex);
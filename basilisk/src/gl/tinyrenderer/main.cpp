@@ -114,7 +114,7 @@ int main (int argc, char** argv) {
       tiny_line (clip_vert[2], clip_vert[0], &red, thickness, image);
 #endif
 #if 1	    
-      tiny_triangle (clip_vert, &shader, fragment, 1, image); // actual rasterization routine call
+      tiny_triangle (clip_vert, &shader, sizeof (shader), fragment, 1, image); // actual rasterization routine call
 #endif
     }
   }
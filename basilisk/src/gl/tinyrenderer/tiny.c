@@ -1,9 +1,12 @@
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <limits.h>
 #include "geometry.h"
 #include "tiny.h"
 #define sq(x) ((x)*(x))
+#define min(a,b) ((a) < (b) ? (a) : (b))
+#define max(a,b) ((a) > (b) ? (a) : (b))
 static mat4 Viewport;
 
 void tiny_viewport (const int x, const int y, const int w, const int h)
@@ -11,12 +14,128 @@ void tiny_viewport (const int x, const int y, const int w, const int h)
   Viewport = (mat4){{w/2., 0, 0, x + w/2.}, {0, h/2., 0, y + h/2.}, {0,0,1,0}, {0,0,0,1}};
 }
 
+/**
+## Tiles
+
+Primitives are not rasterized immediately. They are stored (together
+with a copy of the data of their fragment shader) and binned into the
+square tiles of the framebuffer which they overlap. When the
+primitives are flushed, the tiles are rasterized independently (in
+parallel when compiled with OpenMP, see the *libfb_tiny_omp.a*
+target of the [Makefile](../Makefile)). Within each tile, primitives
+are processed in the order in which they were submitted and the
+pixels are computed exactly as before, so that the image is identical
+to the one obtained with immediate rasterization.
+
+Primitives are flushed when the image or the depth buffer are read,
+when the framebuffer is destroyed, when too many primitives are
+pending, or explicitly with tiny_flush() (for example when the global
+state used by fragment shaders changes, see [fb_tiny.c](../fb_tiny.c)). */
+
+#define TILE 64
+#define MAXPRIMITIVES (1 << 16)
+
+enum { TRIANGLE, LINE, POINT };
+
+typedef struct {
+  int type, bbox[4]; // bbox: xmin, ymin, xmax, ymax
+  union {
+    struct {
+      vec2 v[3];        // screen coordinates
+      real t[3], z[3];  // homogeneous coordinates and clip depths
+      real area;
+      TinyShader fragment;
+      size_t shader;    // offset of the shader data
+    } triangle;
+    struct {
+      int x0, y0, x1, y1;
+      real z0, z1;
+      TinyColor color;
+    } line;
+    struct {
+      vec2 b;
+      real z;
+      float radius;
+      TinyColor color;
+    } point;
+  } p;
+} TinyPrimitive;
+
+typedef struct {
+  int * index, n, size;
+} TinyBin;
+
+typedef struct _TinyQueue {
+  TinyPrimitive * p;
+  int n, size;
+  char * data;
+  size_t len, dsize;
+  int nx, ny;
+  TinyBin * bins;
+} TinyQueue;
+
+static TinyQueue * queue_new (int width, int height)
+{
+  TinyQueue * q = (TinyQueue *) calloc (1, sizeof (TinyQueue));
+  q->nx = (width + TILE - 1)/TILE, q->ny = (height + TILE - 1)/TILE;
+  q->bins = (TinyBin *) calloc (q->nx*q->ny, sizeof (TinyBin));
+  return q;
+}
+
+static void queue_destroy (TinyQueue * q)
+{
+  for (int i = 0; i < q->nx*q->ny; i++)
+    free (q->bins[i].index);
+  free (q->bins);
+  free (q->p);
+  free (q->data);
+  free (q);
+}
+
+/**
+Adds a primitive (with a copy of *size* bytes of *data*, if any) and
+bins it. */
+
+static void queue_add (framebuffer * image, TinyPrimitive * p,
+		       const void * data, size_t size)
+{
+  TinyQueue * q = image->queue;
+  if (q->n == MAXPRIMITIVES)
+    tiny_flush (image);
+  if (size) {
+    size_t offset = (q->len + 15) & ~(size_t) 15;
+    if (offset + size > q->dsize) {
+      q->dsize = 2*(offset + size);
+      q->data = (char *) realloc (q->data, q->dsize);
+    }
+    memcpy (q->data + offset, data, size);
+    p->p.triangle.shader = offset;
+    q->len = offset + size;
+  }
+  if (q->n == q->size) {
+    q->size = q->size ? 2*q->size : 1024;
+    q->p = (TinyPrimitive *) realloc (q->p, q->size*sizeof (TinyPrimitive));
+  }
+  q->p[q->n] = *p;
+  for (int j = p->bbox[1]/TILE; j <= p->bbox[3]/TILE; j++)
+    for (int i = p->bbox[0]/TILE; i <= p->bbox[2]/TILE; i++) {
+      TinyBin * b = q->bins + i + j*q->nx;
+      if (b->n == b->size) {
+	b->size = b->size ? 2*b->size : 64;
+	b->index = (int *) realloc (b->index, b->size*sizeof (int));
+      }
+      b->index[b->n++] = q->n;
+    }
+  q->n++;
+}
+
 /**
 ## Framebuffer */
 
 framebuffer * TinyFramebuffer = NULL;
 
 void framebuffer_destroy (framebuffer * p) {
+  queue_destroy (p->queue);
   free (p->image);
   free (p->zbuffer);
   free (p->depth);
@@ -34,17 +153,20 @@ framebuffer * framebuffer_new (unsigned width, unsigned height)
   real * p = f->zbuffer;
   for (unsigned int i = 0; i < width*height; i++, p++)
     *p = 1e30;
+  f->queue = queue_new (width, height);
   TinyFramebuffer = f;
   tiny_viewport (0., 0., width, height);
   return f;
 }
 
 unsigned char * framebuffer_image (framebuffer * p) {
+  tiny_flush (p);
   return p->image;
 }
 
 float * framebuffer_depth (framebuffer * p)
 {
+  tiny_flush (p);
   if (!p->depth)
     p->depth = (float *) malloc (p->width*p->height*sizeof (float));
   real * z = p->zbuffer;
@@ -66,8 +188,6 @@ void framebuffer_set_depth (framebuffer * f, int x, int y, const TinyColor * col
 /**
 ## Primitives */
 
-#define min(a,b) ((a) < (b) ? (a) : (b))
-#define max(a,b) ((a) > (b) ? (a) : (b))
 #define swap(a,b) do { typeof (a) c; c = a; a = b; b = c; } while (0)
 
 static int constant_color (const void * data, const vec3 bar, TinyColor * frag_color)
@@ -84,7 +204,8 @@ real orient2d (const vec2 a, const vec2 b, const vec2 c)
 }
 
 void tiny_triangle (const vec4 clip_verts[3],
-		    const void * shader, const TinyShader fragment,
+		    const void * shader, size_t size,
+		    const TinyShader fragment,
 		    const int face,
 		    framebuffer * image)
 {
@@ -102,7 +223,7 @@ void tiny_triangle (const vec4 clip_verts[3],
   // backface culling
   real area = orient2d (v[0], v[1], v[2]);
   if (!area || face*area < 0) return;
-  
+
   int bboxmin[2] = {100000, 100000};
   int bboxmax[2] = {- 100000, - 100000};
   for (int i = 0; i < 3; i++) {
@@ -110,35 +231,62 @@ void tiny_triangle (const vec4 clip_verts[3],
     if (bboxmax[0] < v[i].x) bboxmax[0] = v[i].x;
     if (bboxmin[1] > v[i].y) bboxmin[1] = v[i].y;
     if (bboxmax[1] < v[i].y) bboxmax[1] = v[i].y;
-  } // fixme: make this a function and return, also add to tiny_line 
+  } // fixme: make this a function and return, also add to tiny_line
 
   if (bboxmin[0] < 0) bboxmin[0] = 0;
-  if (bboxmin[1] < 0) bboxmin[1] = 0;  
+  if (bboxmin[1] < 0) bboxmin[1] = 0;
   if (bboxmax[0] >= image->width) bboxmax[0] = image->width - 1;
   if (bboxmax[1] >= image->height) bboxmax[1] = image->height - 1;
+  if (bboxmin[0] > bboxmax[0] || bboxmin[1] > bboxmax[1]) return;
 
-#if 0 // OpenMP does accelerate somewhat but not much
-#pragma omp parallel for
-#endif
-  for (int y = bboxmin[1]; y <= bboxmax[1]; y++)
-    for (int x = bboxmin[0]; x <= bboxmax[0]; x++) {
+  TinyPrimitive p = {
+    .type = TRIANGLE,
+    .bbox = {bboxmin[0], bboxmin[1], bboxmax[0], bboxmax[1]},
+    .p.triangle = {
+      .v = {v[0], v[1], v[2]},
+      .t = {pts[0].t, pts[1].t, pts[2].t},
+      .z = {clip_verts[0].z, clip_verts[1].z, clip_verts[2].z},
+      .area = area,
+      .fragment = fragment
+    }
+  };
+  queue_add (image, &p, shader, size);
+}
+
+/**
+The edge functions are evaluated exactly as in orient2d(), but the
+terms which only depend on the row are computed once per row. */
+
+static void rasterize_triangle (const TinyQueue * q, const TinyPrimitive * p,
+				const int box[4], framebuffer * image)
+{
+  const vec2 * v = p->p.triangle.v;
+  const real * t = p->p.triangle.t, area = p->p.triangle.area;
+  const vec3 z = {p->p.triangle.z[0], p->p.triangle.z[1], p->p.triangle.z[2]};
+  const void * shader = q->data + p->p.triangle.shader;
+  TinyShader fragment = p->p.triangle.fragment;
+  for (int y = box[1]; y <= box[3]; y++) {
+    real e0 = (v[2].x - v[1].x)*(y - v[1].y);
+    real e1 = (v[0].x - v[2].x)*(y - v[2].y);
+    real e2 = (v[1].x - v[0].x)*(y - v[0].y);
+    real * zbuffer = image->zbuffer + y*image->width;
+    for (int x = box[0]; x <= box[2]; x++) {
       vec3 bc; // barycentric coordinates
-      if ((bc.x = orient2d (v[1], v[2], (vec2){x, y})/area) >= 0 &&
-	  (bc.y = orient2d (v[2], v[0], (vec2){x, y})/area) >= 0 &&
-	  (bc.z = orient2d (v[0], v[1], (vec2){x, y})/area) >= 0) {
-#if 1
-	// check https://github.com/ssloy/tinyrenderer/wiki/Technical-difficulties-linear-interpolation-with-perspective-deformations	
-	bc = (vec3){bc.x/pts[0].t, bc.y/pts[1].t, bc.z/pts[2].t};
+      if ((bc.x = (e0 - (v[2].y - v[1].y)*(x - v[1].x))/area) >= 0 &&
+	  (bc.y = (e1 - (v[0].y - v[2].y)*(x - v[2].x))/area) >= 0 &&
+	  (bc.z = (e2 - (v[1].y - v[0].y)*(x - v[0].x))/area) >= 0) {
+	// check https://github.com/ssloy/tinyrenderer/wiki/Technical-difficulties-linear-interpolation-with-perspective-deformations
+	bc = (vec3){bc.x/t[0], bc.y/t[1], bc.z/t[2]};
 	bc = vec3_div (bc, bc.x + bc.y + bc.z);
-#endif
-	real frag_depth = vec3_scalar ((vec3){clip_verts[0].z, clip_verts[1].z, clip_verts[2].z}, bc);
-	if (frag_depth >= image->zbuffer[x + y*image->width])
+	real frag_depth = vec3_scalar (z, bc);
+	if (frag_depth >= zbuffer[x])
 	  continue;
 	TinyColor color;
 	if (fragment (shader, bc, &color)) continue; // fragment shader can discard current fragment
 	framebuffer_set_depth (image, x, y, &color, frag_depth);
       }
     }
+  }
 }
 
 void tiny_line (const vec4 clip_verts0, const vec4 clip_verts1, const TinyColor * color, float thickness,
@@ -170,14 +318,35 @@ void tiny_line (const vec4 clip_verts0, const vec4 clip_verts1, const TinyColor
     vec4 v4 = mat4_mul (i, (vec4){ pts[0].t*(v[0].x + (- t.x*ext - t.y)*thickness),
 				   pts[0].t*(v[0].y + (- t.y*ext + t.x)*thickness),
 				   pts[0].z, pts[0].t });
-    tiny_triangle ((vec4[3]){v1, v2, v3}, color, constant_color, 0, image);
-    tiny_triangle ((vec4[3]){v3, v4, v1}, color, constant_color, 0, image);
+    tiny_triangle ((vec4[3]){v1, v2, v3}, color, sizeof (TinyColor), constant_color, 0, image);
+    tiny_triangle ((vec4[3]){v3, v4, v1}, color, sizeof (TinyColor), constant_color, 0, image);
     return;
   }
-  
+
   int x0 = v[0].x, y0 = v[0].y, x1 = v[1].x, y1 = v[1].y;
   if (x1 == x0 && y1 == y0) return;
-  real z0 = clip_verts0.z, z1 = clip_verts1.z;
+  int bbox[4] = {
+    max (min (x0, x1), 0), max (min (y0, y1), 0),
+    min (max (x0, x1), image->width - 1), min (max (y0, y1), image->height - 1)
+  };
+  if (bbox[0] > bbox[2] || bbox[1] > bbox[3]) return;
+  TinyPrimitive p = {
+    .type = LINE,
+    .bbox = {bbox[0], bbox[1], bbox[2], bbox[3]},
+    .p.line = {x0, y0, x1, y1, clip_verts0.z, clip_verts1.z, *color}
+  };
+  queue_add (image, &p, NULL, 0);
+}
+
+/**
+Lines are walked entirely, but only the pixels within the tile are
+drawn. */
+
+static void rasterize_line (const TinyPrimitive * p, const int box[4],
+			    framebuffer * image)
+{
+  int x0 = p->p.line.x0, y0 = p->p.line.y0, x1 = p->p.line.x1, y1 = p->p.line.y1;
+  real z0 = p->p.line.z0, z1 = p->p.line.z1;
   // from: http://members.chello.at/~easyfilter/bresenham.html
   int dx = abs (x1 - x0), sx = x0 < x1 ? 1 : -1;
   int dy = abs (y1 - y0), sy = y0 < y1 ? 1 : -1;
@@ -186,9 +355,9 @@ void tiny_line (const vec4 clip_verts0, const vec4 clip_verts1, const TinyColor
   int x = x0, y = y0;
   while (x != x1 || y != y1) {
     real frag_depth = z0 - 0.01 + a*(dx > dy ? (x - x0) : (y - y0));
-    if (x >= 0 && y >= 0 && x < image->width && y < image->height &&
+    if (x >= box[0] && y >= box[1] && x <= box[2] && y <= box[3] &&
 	frag_depth < image->zbuffer[x + y*image->width])
-      framebuffer_set_depth (image, x, y, color, frag_depth);
+      framebuffer_set_depth (image, x, y, &p->p.line.color, frag_depth);
     int e2 = 2*err;
     if (e2 >= - dy) { err -= dy; x += sx; } /* e_xy+e_x > 0 */
     if (e2 <= dx) { err += dx; y += sy; } /* e_xy+e_y < 0 */
@@ -201,10 +370,70 @@ void tiny_point (const vec4 clip_verts0, const TinyColor * color, float radius,
   // point screen coordinates before persp. division
   vec2 b = vec4_proj2 (vec4_div (a, a.t));
   // line screen coordinates after  persp. division
-  for (real x = b.x - radius; x <= b.x + radius; x++) 
-    for (real y = b.y - radius; y <= b.y + radius; y++) 
+  if (!(b.x + radius >= 0 && b.y + radius >= 0 &&
+	b.x - radius < image->width && b.y - radius < image->height))
+    return;
+  int bbox[4] = {
+    max (b.x - radius, 0), max (b.y - radius, 0),
+    min (b.x + radius, image->width - 1), min (b.y + radius, image->height - 1)
+  };
+  if (bbox[0] > bbox[2] || bbox[1] > bbox[3]) return;
+  TinyPrimitive p = {
+    .type = POINT,
+    .bbox = {bbox[0], bbox[1], bbox[2], bbox[3]},
+    .p.point = {b, clip_verts0.z, radius, *color}
+  };
+  queue_add (image, &p, NULL, 0);
+}
+
+static void rasterize_point (const TinyPrimitive * p, const int box[4],
+			     framebuffer * image)
+{
+  vec2 b = p->p.point.b;
+  float radius = p->p.point.radius;
+  real z = p->p.point.z;
+  for (real x = b.x - radius; x <= b.x + radius; x++)
+    for (real y = b.y - radius; y <= b.y + radius; y++)
       if (sq(x - b.x) + sq(y - b.y) < sq(radius) &&
 	  x >= 0 && y >= 0 && x < image->width &&  y < image->height &&
-	  clip_verts0.z < image->zbuffer[(int)x + (int)y*image->width])
-	framebuffer_set_depth (image, x, y, color, clip_verts0.z);
+	  (int)x >= box[0] && (int)x <= box[2] &&
+	  (int)y >= box[1] && (int)y <= box[3] &&
+	  z < image->zbuffer[(int)x + (int)y*image->width])
+	framebuffer_set_depth (image, x, y, &p->p.point.color, z);
+}
+
+/**
+## Rasterization of the pending primitives */
+
+void tiny_flush (framebuffer * image)
+{
+  TinyQueue * q = image->queue;
+  if (!q->n)
+    return;
+  int ntiles = q->nx*q->ny;
+#if _OPENMP
+#pragma omp parallel for schedule(dynamic)
+#endif
+  for (int k = 0; k < ntiles; k++) {
+    TinyBin * b = q->bins + k;
+    int x0 = (k % q->nx)*TILE, y0 = (k / q->nx)*TILE;
+    int tile[4] = {
+      x0, y0,
+      min (x0 + TILE, image->width) - 1, min (y0 + TILE, image->height) - 1
+    };
+    for (int i = 0; i < b->n; i++) {
+      const TinyPrimitive * p = q->p + b->index[i];
+      int box[4] = {
+	max (tile[0], p->bbox[0]), max (tile[1], p->bbox[1]),
+	min (tile[2], p->bbox[2]), min (tile[3], p->bbox[3])
+      };
+      switch (p->type) {
+      case TRIANGLE: rasterize_triangle (q, p, box, image); break;
+      case LINE:     rasterize_line (p, box, image); break;
+      case POINT:    rasterize_point (p, box, image); break;
+      }
+    }
+    b->n = 0;
+  }
+  q->n = 0, q->len = 0;
 }
@@ -3,6 +3,7 @@ typedef struct { // fixme: should be opaque
   int width, height;
   real * zbuffer;
   float * depth;
+  struct _TinyQueue * queue; // primitives waiting to be rasterized
 } framebuffer;
 
 framebuffer * framebuffer_new (unsigned width, unsigned height);
@@ -21,7 +22,8 @@ typedef struct {
 typedef int (* TinyShader) (const void * shader, const vec3 bar, TinyColor * color);
 
 void tiny_triangle (const vec4 clip_verts[3],
-		    const void * shader, const TinyShader fragment,
+		    const void * shader, size_t size, // shader data and its size
+		    const TinyShader fragment,
 		    int face, // -1: back, 0: front and back, 1: front
 		    framebuffer * image);
 void tiny_line (const vec4 clip_verts0, const vec4 clip_verts1,
@@ -29,3 +31,4 @@ void tiny_line (const vec4 clip_verts0, const vec4 clip_verts1,
 		framebuffer * image);
 void tiny_point (const vec4 clip_verts0, const TinyColor * color, float raidus,
 		 framebuffer * image);
+void tiny_flush (framebuffer * image);
@@ -162,6 +162,58 @@ static void init_block_scalar (scalar sb, const char * name, const char * ext,
 @define interpreter_set_int(...)
 @define interpreter_reset_scalar(...)
 
+/**
+Function-local fields (e.g. `scalar cc[];`) are allocated when they
+enter scope and freed when they leave it. Their slots are reused by
+the next temporaries but, on trees, the record of each cell keeps the
+width reached by the largest number of simultaneous temporaries.
+
+To bound this, `scratch_highwater` records the number of slots used
+during the current timestep. `scratch_recycle()` is called at the end
+of each timestep by the time loops and releases the trailing free
+slots if this high-water mark is smaller than the width of the record
+by at least a fraction `scratch_shrink` of this width. Shrinking
+requires a copy of the entire grid, so the record grows again if a
+later timestep needs more slots (e.g. for an event which is not
+called at every timestep). This width is then used as a floor below
+which the record is never shrunk again, so that periodic peaks do not
+cause repeated copies. With the GNU C library, the memory freed by
+shrinking is returned to the system using `malloc_trim()`. On GPUs,
+the storage buffers can only grow and the slots are never released. */
+
+@if __GLIBC__
+@include <malloc.h>
+@endif
+
+double scratch_shrink = 0.1;
+static int scratch_highwater = 0, scratch_floor = 0;
+static bool scratch_shrunk = false;
+
+static void scratch_use (scalar s, int block)
+{
+  if (s.i + block > scratch_highwater)
+    scratch_highwater = s.i + block;
+}
+
+void scratch_recycle()
+{
+#if !_GPU
+  int nvar = datasize/sizeof(real);
+  scalar s = {nvar - 1};
+  while (s.i >= scratch_highwater && s.freed)
+    s.i--;
+  int used = max (s.i + 1, max (scratch_highwater, scratch_floor));
+  if (used < nvar && nvar - used >= scratch_shrink*nvar) {
+    realloc_scalar ((used - nvar)*sizeof(real));
+    scratch_shrunk = true;
+@if __GLIBC__
+    malloc_trim (0);
+@endif
+  }
+#endif // !_GPU
+  scratch_highwater = 0;
+}
+
 scalar alloc_block_scalar (const char * name, const char * ext, int block)
 {
   interpreter_set_int (&block);
@@ -179,7 +231,16 @@ scalar alloc_block_scalar (const char * name, const char * ext, int block)
 	init_block_scalar (sb, name, ext, n, block);
 	interpreter_reset_scalar (sb);
       }
+#if TREE
+      // the slots of freed leaf-only fields may still be trimmed
+      for (sb.i = s.i, n = 0; n < block; n++, sb.i++)
+	if (leaf_stored (sb)) {
+	  tree_compact();
+	  break;
+	}
+#endif
       trash (((scalar []){s, {-1}})); // fixme: only trashes one block?
+      scratch_use (s, block);
       return s;
     }
     s.i = sb.i + 1;
@@ -201,7 +262,10 @@ scalar alloc_block_scalar (const char * name, const char * ext, int block)
   }
   // allocate extra space on the grid
   realloc_scalar (block*sizeof(real));
+  if (scratch_shrunk)
+    scratch_floor = nvar;
   trash (((scalar []){s, {-1}})); // fixme: only trashes one block?
+  scratch_use (s, block);
   return s;
 }
 
@@ -527,16 +591,20 @@ void boundary_internal (scalar * list, const char * fname, int line)
 	if (s.face != 2) // flux only
 	  listc = list_add_depends (listc, s);
       }
+      else {
 #if 0
-      else
 	fprintf (stderr, "warning: bc already applied on '%s'\n", s.name);
 #endif
+	boundary_stats.avoided++;
+      }
     }
   if (flux) {
     boundary_face (listf);
     foreach_dimension()
       free (listf.x);
   }
+  if (flux || listc)
+    boundary_stats.calls++;
   if (listc) {
 #if PRINTBOUNDARY
     fprintf (stderr, "boundary_internal: listc:");
@@ -544,6 +612,7 @@ void boundary_internal (scalar * list, const char * fname, int line)
       fprintf (stderr, " %d:%s", s.i, s.name);
     fputc ('\n', stderr);
 #endif
+    boundary_stats.fields += list_len (listc);
     boundary_level (listc, -1);
     for (scalar s in listc)
       s.dirty = false;
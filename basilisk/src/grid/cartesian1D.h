@@ -204,10 +204,18 @@ void realloc_scalar (int size)
 {
   Cartesian * p = cartesian;
   size_t len = (p->n + 2);
-  qrealloc (p->d, len*(datasize + size), char);
-  char * data = p->d + (len - 1)*datasize;
-  for (int i = p->n + 1; i > 0; i--, data -= datasize)
-    memmove (data + i*size, data, datasize);
+  if (size > 0) {
+    qrealloc (p->d, len*(datasize + size), char);
+    char * data = p->d + (len - 1)*datasize;
+    for (int i = p->n + 1; i > 0; i--, data -= datasize)
+      memmove (data + i*size, data, datasize);
+  }
+  else {
+    char * data = p->d + datasize;
+    for (int i = 1; i < len; i++, data += datasize)
+      memmove (data + i*size, data, datasize + size);
+    qrealloc (p->d, len*(datasize + size), char);
+  }
   datasize += size;
 }
 
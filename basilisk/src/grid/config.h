@@ -19,10 +19,20 @@
 @define trash(x)  // data trashing is disabled by default. Turn it on with
                   // -DTRASH=1
 
+#if TRACE != 3 // see below for TRACE == 3
 auto macro2 BEGIN_FOREACH() {{...}}
+#endif
+
+/**
+With `-DSIMD=1 -fopenmp-simd` (and without OpenMP), the OpenMP
+directives are also emitted: the compiler then only uses the `simd`
+directives (and the `declare reduction` declarations) and ignores the
+others, while serial loops disable all of them, as with OpenMP. */
 
+#if _OPENMP || SIMD
 #if _OPENMP
 @ include <omp.h>
+#endif
 @ define OMP(x) Pragma(#x)
 
 macro OMP_SERIAL()
@@ -35,11 +45,12 @@ macro OMP_SERIAL()
   @define OMP(x) Pragma(#x)
   ; // necessary so that the preproc above is included
 }
-   
-#elif _MPI
-
+#else
 @ define OMP(x)
 macro OMP_SERIAL() {{...}}
+#endif
+
+#if _MPI && !_OPENMP
 
 @ include <mpi.h>
 static int mpi_rank, mpi_npe;
@@ -47,11 +58,6 @@ static int mpi_rank, mpi_npe;
 @ define pid() mpi_rank
 @ define npe() mpi_npe
 
-#else // not MPI, not OpenMP
-
-@ define OMP(x)
-macro OMP_SERIAL() {{...}}
-
 #endif // _MPI
 
 #if _CADNA
@@ -216,76 +222,246 @@ static void trace_off()
 #endif
 @  define tracing(func, file, line)     trace_push (TRACE_TYPE(func), func)
 @  define end_tracing(func, file, line) trace_pop (TRACE_TYPE(func), func)
+@  define tracing_function(func, file, line)     tracing(func, file, line)
+@  define end_tracing_function(func, file, line) end_tracing(func, file, line)
 
 #elif TRACE // built-in function tracing
 
+/**
+Each function marked with `trace` gets its own static slot (the
+`_trace_slot` variable declared by `tracing_function()`), so that the
+statistics of a call are accumulated without any lookup. The slot is
+resolved once, on the first call.
+
+The times are measured using the monotonic clock and each (OpenMP)
+thread has its own stack of calls.
+
+When *TRACE* is larger than two, the last `TRACE_EVENTS` calls of each
+thread are also kept in a ring buffer which is written, when tracing
+stops, in the [Chrome trace event
+format](https://docs.google.com/document/d/1CvAClvFfyA5R-PhYUmn5OOQtYMH4h6I0nSsKchNAySU)
+in the `timeline.json` file (or `timeline-pid.json` for each process
+when using MPI). This file can be displayed using e.g.
+[Perfetto](https://ui.perfetto.dev). When *TRACE* is equal to three,
+foreach loops are also traced (see `BEGIN_FOREACH()` below).
+
+### Hardware counters
+
+When *TRACE_PERF* is set (on Linux), the number of cycles,
+instructions, last-level cache references and misses are also counted
+for each call, using the `perf_event_open()` system call. These are
+inclusive counts (i.e. they include the counts of the traced functions
+which are called) and only the calling thread is counted. */
+
+#if TRACE_PERF
+@ include <linux/perf_event.h>
+@ include <sys/syscall.h>
+@ include <unistd.h>
+# define TRACE_COUNTERS 4
+#else
+# define TRACE_COUNTERS 0
+#endif
+
+#define TRACE_STACK (2 + TRACE_COUNTERS) // start, children, counters
+
 typedef struct {
   char * func, * file;
-  int line, calls;
+  int line;
+  long calls;
   double total, self;
 #if _MPI
   double min, max;
 #endif // _MPI
+#if TRACE_PERF
+  double count[TRACE_COUNTERS];
+#endif
 } TraceIndex;
-				      
+
+#if TRACE > 2
+#ifndef TRACE_EVENTS
+# define TRACE_EVENTS 65536
+#endif
+
+typedef struct {
+  TraceIndex * t;
+  double start, duration;
+} TraceEvent;
+#endif // TRACE > 2
+
+typedef struct {
+  Array stack;
+#if TRACE_PERF
+  int perf; // the file descriptor of the counters + 1 (or -1)
+#endif
+#if TRACE > 2
+  TraceEvent * events;
+  long nevents;
+#endif
+} TraceThread;
+
 struct {
-  Array stack, index;
+  Array index; // an array of (TraceIndex *)
+  TraceThread * thread;
+  int nthreads;
   double t0;
 } Trace = {
-  {NULL, 0, 0}, {NULL, 0, 0},
-  -1
+  {NULL, 0, 0}, NULL, 0, -1
 };
 
-static void trace_add (const char * func, const char * file, int line,
-		       double total, double self)
-{
-  TraceIndex * t = (TraceIndex *) Trace.index.p;
-  int i, len = Trace.index.len/sizeof(TraceIndex);
-  for (i = 0; i < len; i++, t++)
-    if (t->line == line && !strcmp (func, t->func) && !strcmp (file, t->file))
-      break;
-  if (i == len) {
-    TraceIndex t = {strdup(func), strdup(file), line, 1, total, self};
-    array_append (&Trace.index, &t, sizeof(TraceIndex));
+static double trace_time()
+{
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + 1e-9*ts.tv_nsec;
+}
+
+#if TRACE_PERF
+static int trace_counters_open()
+{
+  static const unsigned long long config[TRACE_COUNTERS] = {
+    PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+    PERF_COUNT_HW_CACHE_REFERENCES, PERF_COUNT_HW_CACHE_MISSES
+  };
+  int fd[TRACE_COUNTERS];
+  for (int i = 0; i < TRACE_COUNTERS; i++) {
+    struct perf_event_attr a;
+    memset (&a, 0, sizeof (a));
+    a.size = sizeof (a);
+    a.type = PERF_TYPE_HARDWARE;
+    a.config = config[i];
+    a.exclude_kernel = a.exclude_hv = 1;
+    a.read_format = PERF_FORMAT_GROUP;
+    fd[i] = syscall (__NR_perf_event_open, &a, 0, -1, i ? fd[0] : -1, 0);
+    if (fd[i] < 0) {
+      static bool warned = false;
+      if (!warned)
+	perror ("warning: trace: perf_event_open"), warned = true;
+      for (int j = 0; j < i; j++)
+	close (fd[j]);
+      return -1;
+    }
   }
+  return fd[0] + 1;
+}
+
+static void trace_counters_read (TraceThread * th, double * count)
+{
+  struct {
+    uint64_t nr, value[TRACE_COUNTERS];
+  } buf;
+  if (th->perf > 0 &&
+      read (th->perf - 1, &buf, sizeof (buf)) == sizeof (buf))
+    for (int i = 0; i < TRACE_COUNTERS; i++)
+      count[i] = buf.value[i];
   else
-    t->calls++, t->total += total, t->self += self;
+    for (int i = 0; i < TRACE_COUNTERS; i++)
+      count[i] = 0.;
+}
+#endif // TRACE_PERF
+
+static TraceThread * trace_thread()
+{
+  if (!Trace.thread) {
+    OMP (omp critical (trace))
+    if (!Trace.thread) {
+#if _OPENMP
+      int nthreads = omp_get_max_threads();
+#else
+      int nthreads = 1;
+#endif
+      Trace.t0 = trace_time();
+      Trace.nthreads = nthreads;
+      Trace.thread = qcalloc (nthreads, TraceThread);
+    }
+  }
+#if _OPENMP
+  int tid = omp_get_thread_num();
+  assert (tid < Trace.nthreads);
+  TraceThread * th = Trace.thread + tid;
+#else
+  TraceThread * th = Trace.thread;
+#endif
+#if TRACE_PERF
+  if (!th->perf)
+    th->perf = trace_counters_open();
+#endif
+  return th;
+}
+
+static TraceIndex * trace_index (const char * func, const char * file, int line)
+{
+  TraceIndex * index = NULL;
+  OMP (omp critical (trace))
+  {
+    TraceIndex ** t = (TraceIndex **) Trace.index.p;
+    int i, len = Trace.index.len/sizeof(TraceIndex *);
+    for (i = 0; i < len; i++, t++)
+      if ((*t)->line == line && !strcmp (func, (*t)->func) &&
+	  !strcmp (file, (*t)->file))
+	break;
+    if (i == len) {
+      index = qcalloc (1, TraceIndex);
+      index->func = strdup (func), index->file = strdup (file);
+      index->line = line;
+      array_append (&Trace.index, &index, sizeof(TraceIndex *));
+    }
+    else
+      index = *t;
+  }
+  return index;
 }
 
 static void tracing (const char * func, const char * file, int line)
 {
-  struct timeval tv;
-  gettimeofday (&tv, NULL);
-  if (Trace.t0 < 0)
-    Trace.t0 = tv.tv_sec + tv.tv_usec/1e6;
-  double t[2] = {(tv.tv_sec - Trace.t0) + tv.tv_usec/1e6, 0.};
-  array_append (&Trace.stack, t, 2*sizeof(double));
-#if 0
-  fprintf (stderr, "trace %s:%s:%d t: %g sum: %g\n",
-	   func, file, line, t[0], t[1]);
+  TraceThread * th = trace_thread();
+  double t[TRACE_STACK] = {trace_time() - Trace.t0, 0.};
+#if TRACE_PERF
+  trace_counters_read (th, t + 2);
 #endif
+  array_append (&th->stack, t, TRACE_STACK*sizeof(double));
 #if NVTX
   nvtxRangePush (func);
 #endif
 }
 
-static void end_tracing (const char * func, const char * file, int line)
+static void trace_pop (TraceIndex * index)
 {
-  struct timeval tv;
-  gettimeofday (&tv, NULL);
-  double te = (tv.tv_sec - Trace.t0) + tv.tv_usec/1e6;
-  double * t = (double *) Trace.stack.p;
-  assert (Trace.stack.len >= 2*sizeof(double));
-  t += Trace.stack.len/sizeof(double) - 2;
-  Trace.stack.len -= 2*sizeof(double);
-  double dt = te - t[0];
-#if 0
-  fprintf (stderr, "end trace %s:%s:%d ts: %g te: %g dt: %g sum: %g\n",
-	   func, file, line, t[0], te, dt, t[1]);
+  double te = trace_time() - Trace.t0;
+  TraceThread * th = trace_thread();
+#if TRACE_PERF
+  double count[TRACE_COUNTERS];
+  trace_counters_read (th, count);
 #endif
-  trace_add (func, file, line, dt, dt - t[1]);
-  if (Trace.stack.len >= 2*sizeof(double)) {
-    t -= 2;
+  double * t = (double *) th->stack.p;
+  assert (th->stack.len >= TRACE_STACK*sizeof(double));
+  t += th->stack.len/sizeof(double) - TRACE_STACK;
+  th->stack.len -= TRACE_STACK*sizeof(double);
+  double dt = te - t[0], self = dt - t[1];
+#if TRACE_PERF
+  for (int i = 0; i < TRACE_COUNTERS; i++) {
+    double c = count[i] - t[2 + i];
+    OMP (omp atomic)
+      index->count[i] += c;
+  }
+#endif
+#if _OPENMP
+  OMP (omp atomic)
+    index->calls++;
+  OMP (omp atomic)
+    index->total += dt;
+  OMP (omp atomic)
+    index->self += self;
+#else
+  index->calls++, index->total += dt, index->self += self;
+#endif
+#if TRACE > 2
+  if (!th->events)
+    th->events = qmalloc (TRACE_EVENTS, TraceEvent);
+  TraceEvent * e = th->events + th->nevents++ % TRACE_EVENTS;
+  e->t = index, e->start = t[0], e->duration = dt;
+#endif
+  if (th->stack.len >= TRACE_STACK*sizeof(double)) {
+    t -= TRACE_STACK;
     t[1] += dt;
   }
 #if NVTX
@@ -293,6 +469,50 @@ static void end_tracing (const char * func, const char * file, int line)
 #endif
 }
 
+static inline void end_tracing (const char * func, const char * file, int line)
+{
+  trace_pop (trace_index (func, file, line));
+}
+
+static void tracing_slot (TraceIndex ** slot,
+			  const char * func, const char * file, int line)
+{
+  if (!*slot)
+    *slot = trace_index (func, file, line);
+  tracing (func, file, line);
+}
+
+/**
+Grids which run asynchronously (i.e. [on GPUs](gpu/gpu.h)) redefine
+`trace_sync()` so that pending work is completed before the clock is
+read, both when entering and leaving traced functions. */
+
+@define trace_sync()
+
+@def tracing_function(func, file, line)
+  static TraceIndex * _trace_slot = NULL;
+  trace_sync();
+  tracing_slot (&_trace_slot, func, file, line)
+@
+@def end_tracing_function(func, file, line) do {
+  trace_sync();
+  trace_pop (_trace_slot);
+} while(0) @
+
+#if TRACE == 3 // also trace foreach loops
+auto macro2 BEGIN_FOREACH()
+{
+  {
+    static TraceIndex * _trace_loop = NULL;
+    trace_sync();
+    tracing_slot (&_trace_loop, "foreach", S__FILE__, S_LINENO);
+    {...}
+    trace_sync();
+    trace_pop (_trace_loop);
+  }
+}
+#endif
+
 static int compar_self (const void * p1, const void * p2)
 {
   const TraceIndex * t1 = p1, * t2 = p2;
@@ -311,12 +531,12 @@ static int compar_func (const void * p1, const void * p2)
 
 void trace_print (FILE * fp, double threshold)
 {
-  int i, len = Trace.index.len/sizeof(TraceIndex);
+  int i, len = Trace.index.len/sizeof(TraceIndex *);
   double total = 0.;
-  TraceIndex * t;
+  TraceIndex * t, ** tp;
   Array * index = array_new();
-  for (i = 0, t = (TraceIndex *) Trace.index.p; i < len; i++, t++)
-    array_append (index, t, sizeof(TraceIndex)), total += t->self;
+  for (i = 0, tp = (TraceIndex **) Trace.index.p; i < len; i++, tp++)
+    array_append (index, *tp, sizeof(TraceIndex)), total += (*tp)->self;
 #if _MPI
   qsort (index->p, len, sizeof(TraceIndex), compar_func);
   double tot[len], self[len], min[len], max[len];
@@ -332,45 +552,152 @@ void trace_print (FILE * fp, double threshold)
   for (i = 0, t = (TraceIndex *) index->p; i < len; i++, t++)
     t->total = tot[i]/npe(), t->self = self[i]/npe(),
       t->max = max[i], t->min = min[i], total += t->self;
+#if TRACE_PERF
+  for (i = 0, t = (TraceIndex *) index->p; i < len; i++, t++)
+    MPI_Reduce (pid() ? t->count : MPI_IN_PLACE, t->count, TRACE_COUNTERS,
+		MPI_DOUBLE, MPI_SUM, 0, MPI_COMM_WORLD);
+#endif
 #endif // _MPI
   qsort (index->p, len, sizeof(TraceIndex), compar_self);
-  fprintf (fp, "   calls    total     self   %% total   function\n");
+  fprintf (fp, "   calls    total     self   %% total");
+#if TRACE_PERF
+  fprintf (fp, "    IPC  miss%%    GB/s");
+#endif
+  fprintf (fp, "   function\n");
   for (i = 0, t = (TraceIndex *) index->p; i < len; i++, t++)
     if (t->self*100./total > threshold) {
-      fprintf (fp, "%8d   %6.2f   %6.2f     %4.1f%%",
+      fprintf (fp, "%8ld   %6.2f   %6.2f     %4.1f%%",
 	       t->calls, t->total, t->self, t->self*100./total);
 #if _MPI
       fprintf (fp, " (%4.1f%% - %4.1f%%)", t->min*100./total, t->max*100./total);
+#endif
+#if TRACE_PERF
+      if (t->count[0] > 0.) {
+	double bytes = 64.*t->count[3]; // 64-bytes cache lines
+#if _MPI
+	bytes /= npe(); // average per process
+#endif
+	fprintf (fp, "  %5.2f  %4.1f%%  %6.2f",
+		 t->count[1]/t->count[0],
+		 t->count[2] > 0. ? 100.*t->count[3]/t->count[2] : 0.,
+		 t->total > 0. ? bytes/(t->total*1e9) : 0.);
+      }
+      else
+	fprintf (fp, "    n/a    n/a     n/a");
 #endif
       fprintf (fp, "   %s():%s:%d\n", t->func, t->file, t->line);
     }
   fflush (fp);
   array_free (index);
-  for (i = 0, t = (TraceIndex *) Trace.index.p; i < len; i++, t++)
-    t->calls = t->total = t->self = 0.;
+  for (i = 0, tp = (TraceIndex **) Trace.index.p; i < len; i++, tp++) {
+    (*tp)->calls = (*tp)->total = (*tp)->self = 0.;
+#if TRACE_PERF
+    for (int j = 0; j < TRACE_COUNTERS; j++)
+      (*tp)->count[j] = 0.;
+#endif
+  }
+}
+
+#if TRACE_PERF
+/**
+The statistics (for this process) can also be written in CSV format,
+which is easier to process and plot. This is done automatically, in
+`trace.csv` (or `trace-pid.csv`), when tracing stops. */
+
+void trace_csv (FILE * fp)
+{
+  fputs ("function,file,line,calls,total,self,"
+	 "cycles,instructions,references,misses\n", fp);
+  int i, len = Trace.index.len/sizeof(TraceIndex *);
+  TraceIndex ** t;
+  for (i = 0, t = (TraceIndex **) Trace.index.p; i < len; i++, t++)
+    fprintf (fp, "%s,%s,%d,%ld,%g,%g,%.0f,%.0f,%.0f,%.0f\n",
+	     (*t)->func, (*t)->file, (*t)->line, (*t)->calls,
+	     (*t)->total, (*t)->self,
+	     (*t)->count[0], (*t)->count[1], (*t)->count[2], (*t)->count[3]);
+  fflush (fp);
 }
+#endif // TRACE_PERF
+
+#if TRACE > 2
+static void trace_timeline()
+{
+  char name[80] = "timeline.json";
+  int rank = 0;
+#if _MPI
+  MPI_Comm_rank (MPI_COMM_WORLD, &rank);
+  snprintf (name, 80, "timeline-%d.json", rank);
+#endif
+  FILE * fp = fopen (name, "w");
+  if (!fp) {
+    perror (name);
+    return;
+  }
+  fputs ("{\"traceEvents\":[", fp);
+  char * sep = "\n";
+  for (int i = 0; i < Trace.nthreads; i++) {
+    TraceThread * th = Trace.thread + i;
+    long start = th->nevents > TRACE_EVENTS ? th->nevents - TRACE_EVENTS : 0;
+    for (long j = start; j < th->nevents; j++, sep = ",\n") {
+      TraceEvent * e = th->events + j % TRACE_EVENTS;
+      fprintf (fp, "%s{\"name\":\"%s\",\"cat\":\"%s:%d\",\"ph\":\"X\","
+	       "\"ts\":%.3f,\"dur\":%.3f,\"pid\":%d,\"tid\":%d}",
+	       sep, e->t->func, e->t->file, e->t->line,
+	       1e6*e->start, 1e6*e->duration, rank, i);
+    }
+  }
+  fputs ("\n]}\n", fp);
+  fclose (fp);
+}
+#endif // TRACE > 2
 
 static void trace_off()
 {
+#if TRACE_PERF
+  char name[80] = "trace.csv";
+#if _MPI
+  int rank;
+  MPI_Comm_rank (MPI_COMM_WORLD, &rank);
+  snprintf (name, 80, "trace-%d.csv", rank);
+#endif
+  FILE * fp = fopen (name, "w");
+  if (fp)
+    trace_csv (fp), fclose (fp);
+#endif // TRACE_PERF
   trace_print (fout, 0.);
+#if TRACE > 2
+  trace_timeline();
+#endif
 
-  int i, len = Trace.index.len/sizeof(TraceIndex);
-  TraceIndex * t;
-  for (i = 0, t = (TraceIndex *) Trace.index.p; i < len; i++, t++)
-    free (t->func), free (t->file);
+  int i, len = Trace.index.len/sizeof(TraceIndex *);
+  TraceIndex ** t;
+  for (i = 0, t = (TraceIndex **) Trace.index.p; i < len; i++, t++)
+    free ((*t)->func), free ((*t)->file), free (*t);
 
   free (Trace.index.p);
   Trace.index.p = NULL;
   Trace.index.len = Trace.index.max = 0;
-  
-  free (Trace.stack.p);
-  Trace.stack.p = NULL;
-  Trace.stack.len = Trace.stack.max = 0;
+
+  for (i = 0; i < Trace.nthreads; i++) {
+    free (Trace.thread[i].stack.p);
+#if TRACE_PERF
+    if (Trace.thread[i].perf > 0)
+      close (Trace.thread[i].perf - 1);
+#endif
+#if TRACE > 2
+    free (Trace.thread[i].events);
+#endif
+  }
+  free (Trace.thread);
+  Trace.thread = NULL;
+  Trace.nthreads = 0;
 }
 
 #else // disable tracing
 @  define tracing(...)
 @  define end_tracing(...)
+@  define tracing_function(...)
+@  define end_tracing_function(...)
 #endif
 
 // OpenMP / MPI
@@ -532,6 +859,22 @@ void mpi_init()
 macro2 OMP_PARALLEL() {{...}}
 @define OMP_PARALLEL(...) OMP(omp parallel S__VA_ARGS__)
 
+/**
+The innermost loops of `foreach()` and `foreach_face()` on
+multigrids are marked as SIMD loops when compiling with OpenMP, or
+with `-DSIMD=1 -fopenmp-simd` for serial code. This is consistent
+with the semantics of `foreach()` which do not guarantee any order of
+traversal (cells are already processed concurrently by OpenMP
+threads). The directive goes through `OMP()`, so that it is disabled
+for `foreach (serial)` loops and includes the reduction clauses. */
+
+macro2 OMP_SIMD() {{...}}
+#if _OPENMP || SIMD
+@ define OMP_SIMD(...) OMP(omp simd S__VA_ARGS__)
+#else
+@ define OMP_SIMD(...)
+#endif
+
 @define NOT_UNUSED(x) (void)(x)
 
 macro2 VARIABLES() { _CATCH; }
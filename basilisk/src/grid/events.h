@@ -14,6 +14,7 @@ struct _Event {
   int i, a;
   void * data;
   Event * next;
+  double cost; // wall-clock time spent in the action
 };
 
 static Event * Events = NULL; // all events
@@ -161,6 +162,13 @@ below to control (i.e. shorten) the events loop. */
 
 static bool overload_event() { return true; }
 
+static double event_clock()
+{
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + 1e-9*ts.tv_nsec;
+}
+
 static int event_do (Event * ev, bool action)
 {
   if ((iter > ev->i && t > ev->t) || !event_cond (ev, iter, t))
@@ -172,8 +180,10 @@ static int event_do (Event * ev, bool action)
 #if DEBUG_EVENTS
 	event_print (e, stderr);
 #endif
+	double start = event_clock();
 	if ((* e->action) (iter, t, e))
 	  finished = true;
+	e->cost += event_clock() - start;
       }
       if (finished) {
 	event_finished (ev);
@@ -12,10 +12,15 @@ BEGIN {
     }
 }
 END {
-    print "Title Inteli7 IntelUHD RTX3050 RTX6000 RTX4090"
-    for (j = 0; j <= 5; j++) {
+    if (title == "")
+	title = "Inteli7 IntelUHD RTX3050 RTX6000 RTX4090"
+    print "Title", title
+    ncols = split (title, columns)
+    if (nrows == 0)
+	nrows = 6
+    for (j = 0; j < nrows; j++) {
 	printf ("%d^2 ", 2**(j + minlevel));
-	for (i = 0; i < 5; i++)
+	for (i = 0; i < ncols; i++)
 	    printf ("%g ", a[i][j]);
 	print ""
     }	
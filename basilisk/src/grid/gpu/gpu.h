@@ -353,12 +353,14 @@ macro2 foreach_level_or_leaf_stencil (int _level, char flags, Reduce reductions,
 }
 
 @ifndef tracing
+  @ undef trace_sync
+  @ define trace_sync() do { if (glFinish) glFinish(); } while(0)
   @ def tracing(func, file, line) do {
-    if (glFinish) glFinish();
+    trace_sync();
     tracing(func, file, line);
   } while(0) @
   @ def end_tracing(func, file, line) do {
-    if (glFinish) glFinish();
+    trace_sync();
     end_tracing(func, file, line);
   } while(0) @
 @endif
@@ -3,17 +3,175 @@
    http://www.boost.org/doc/libs/1_55_0/libs/pool/doc/html/boost_pool/pool/pooling.html
 */
 
+@include <sys/mman.h>
+@include <fcntl.h>
+@include <unistd.h>
+
+/* Allocation policy: by default each pool is allocated with
+   malloc(). If `hugepages` is set, pools are carved out of large
+   regions allocated with mmap() and, on Linux, advised to use
+   (transparent) huge pages, which reduces TLB pressure for large
+   trees. With OpenMP, the pages of a new region are first touched in
+   parallel by all threads, so that they are spread across the NUMA
+   nodes of the threads rather than all placed on the node of the
+   (serial) allocating thread. */
+
+struct {
+  bool hugepages; // use huge-page-backed regions
+  size_t region;  // minimum size of a region (bytes)
+} mempool_policy = {false, 1 << 25};
+
+/* Statistics */
+
+struct {
+  size_t pools, bytes;     // current number and size of pools
+  size_t used;             // current size of allocated blocks
+  size_t regions, mapped;  // current number and size of regions
+  size_t maxmapped;        // maximum size of regions
+} mempool_stats = {0};
+
+typedef struct _Region Region;
+
+struct _Region {
+  size_t size, used; // size and used size of the region
+  int pools;         // number of pools carved from this region
+};
+
 typedef struct _Pool Pool;
 
 struct _Pool {
-  Pool * next; // next pool
+  Pool * next;      // next pool
+  Region * region;  // region the pool was carved from (or NULL)
 };
 
+static Region * mempool_region = NULL; // region currently carved from
+
+#define MEMPOOL_HUGE (1 << 21)  // size of a huge page (2MB)
+#define MEMPOOL_ALIGN 64        // pool alignment in a region
+
+static Region * region_new (size_t size)
+{
+  size = (size + MEMPOOL_HUGE - 1)/MEMPOOL_HUGE*MEMPOOL_HUGE;
+  // over-allocate to align the region on a huge page
+  size_t len = size + MEMPOOL_HUGE;
+  /* Anonymous mappings are not part of POSIX 2008: in strict mode
+     (e.g. `-D_XOPEN_SOURCE=700` without `_GNU_SOURCE`) we use a
+     private mapping of /dev/zero, which is equivalent. */
+@if defined(MAP_ANONYMOUS) || defined(MAP_ANON)
+@ifndef MAP_ANONYMOUS
+@define MAP_ANONYMOUS MAP_ANON
+@endif
+  char * p = (char *) mmap (NULL, len, PROT_READ|PROT_WRITE,
+			    MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+@else
+  int fd = open ("/dev/zero", O_RDWR);
+  if (fd < 0)
+    return NULL;
+  char * p = (char *) mmap (NULL, len, PROT_READ|PROT_WRITE,
+			    MAP_PRIVATE, fd, 0);
+  close (fd);
+@endif
+  if (p == MAP_FAILED)
+    return NULL;
+  char * start = p + (MEMPOOL_HUGE - (size_t) p % MEMPOOL_HUGE) % MEMPOOL_HUGE;
+  if (start > p)
+    munmap (p, start - p);
+  if (start + size < p + len)
+    munmap (start + size, p + len - (start + size));
+@ifdef MADV_HUGEPAGE
+  madvise (start, size, MADV_HUGEPAGE);
+@endif
+#if _OPENMP
+  if (omp_get_max_threads() > 1) {
+    long n = size/4096;
+    OMP (omp parallel for schedule(static))
+      for (long i = 0; i < n; i++)
+	start[i*4096] = 0;
+  }
+#endif
+  Region * r = (Region *) start;
+  r->size = size;
+  r->used = MEMPOOL_ALIGN;
+  r->pools = 0;
+  mempool_stats.regions++;
+  mempool_stats.mapped += size;
+  if (mempool_stats.mapped > mempool_stats.maxmapped)
+    mempool_stats.maxmapped = mempool_stats.mapped;
+#if MTRACE
+  pmtrace.mapped += size;
+  if (pmtrace.mapped > pmtrace.maxmapped)
+    pmtrace.maxmapped = pmtrace.mapped;
+#endif
+  return r;
+}
+
+static void region_destroy (Region * r)
+{
+  mempool_stats.regions--;
+  mempool_stats.mapped -= r->size;
+#if MTRACE
+  pmtrace.mapped -= r->size;
+#endif
+  munmap (r, r->size);
+}
+
+static Pool * pool_new (size_t size)
+{
+  Pool * p = NULL;
+  if (mempool_policy.hugepages) {
+    size = (size + MEMPOOL_ALIGN - 1)/MEMPOOL_ALIGN*MEMPOOL_ALIGN;
+    Region * r = mempool_region;
+    if (!r || r->used + size > r->size) {
+      if (r && r->pools == 0)
+	region_destroy (r);
+      r = mempool_region =
+	region_new (max (mempool_policy.region, MEMPOOL_ALIGN + size));
+    }
+    if (r) {
+      p = (Pool *) (((char *) r) + r->used);
+      r->used += size;
+      r->pools++;
+      p->region = r;
+    }
+  }
+  if (!p) {
+    p = (Pool *) malloc (size);
+    p->region = NULL;
+  }
+  p->next = NULL;
+  mempool_stats.pools++;
+  mempool_stats.bytes += size;
+  return p;
+}
+
+static void pool_destroy (Pool * p, size_t size)
+{
+  mempool_stats.pools--;
+  Region * r = p->region;
+  if (r) {
+    size = (size + MEMPOOL_ALIGN - 1)/MEMPOOL_ALIGN*MEMPOOL_ALIGN;
+    mempool_stats.bytes -= size;
+    if (--r->pools == 0) {
+      if (r == mempool_region)
+	r->used = MEMPOOL_ALIGN;
+      else
+	region_destroy (r);
+    }
+  }
+  else {
+    mempool_stats.bytes -= size;
+    free (p);
+  }
+}
+
 typedef struct {
   char * first, * lastb; // first and last free blocks
   size_t size;           // block size
   size_t poolsize;       // pool size
   Pool * pool, * last;   // first and last pools
+  size_t nb;             // number of allocated blocks
+  size_t np;             // number of pools
+  size_t guard;          // unused bytes allocated after each pool
 } Mempool;
 
 typedef struct {
@@ -39,9 +197,10 @@ void mempool_destroy (Mempool * m)
   Pool * p = m->pool;
   while (p) {
     Pool * next = p->next;
-    free (p);
+    pool_destroy (p, m->poolsize + m->guard);
     p = next;
   }
+  mempool_stats.used -= m->nb*m->size;
   free (m);
 }
 
@@ -49,8 +208,8 @@ void * mempool_alloc (Mempool * m)
 {
   if (!m->first) {
     // allocate new pool
-    Pool * p = (Pool *) malloc (m->poolsize);
-    p->next = NULL;
+    Pool * p = pool_new (m->poolsize + m->guard);
+    m->np++;
     if (m->last)
       m->last->next = p;
     else
@@ -74,6 +233,7 @@ void * mempool_alloc (Mempool * m)
     }
   }
   m->first = next;
+  m->nb++, mempool_stats.used += m->size;
 @if TRASH
   double * v = (double *) ret;
   for (int i = 0; i < m->size/sizeof(real); i++)
@@ -99,4 +259,14 @@ void mempool_free (Mempool * m, void * p)
   FreeBlock * b = (FreeBlock *) p;
   b->next = m->first;
   m->first = (char *) p;
+  m->nb--, mempool_stats.used -= m->size;
+}
+
+/* Returns the number of pools which would be released if the
+   allocated blocks were packed into as few pools as possible. */
+
+size_t mempool_excess (Mempool * m)
+{
+  size_t n = (m->poolsize - sizeof(Pool))/m->size;
+  return m->np - (m->nb + n - 1)/n;
 }
@@ -7,6 +7,7 @@ struct {
   size_t overhead, maxoverhead;  // current and maximum profiling overhead
   size_t nr;                     // current number of records
   size_t startrss, maxrss;       // starting and maximum system ressource usage
+  size_t mapped, maxmapped;      // current and maximum mmap()ed memory
   char * fname;                  // trace file name
 } pmtrace;
 
@@ -193,11 +194,15 @@ void pmuntrace (void)
   fprintf (stderr,
 	   "*** MTRACE: max resident  set size: %10ld bytes\n"
 	   "*** MTRACE: max traced memory size: %10ld bytes"
-	   " (tracing overhead %.1g%%)\n"
-	   "%10s    %20s   %s\n",
+	   " (tracing overhead %.1g%%)\n",
 	   pmtrace.maxrss*1024,
-	   pmtrace.max, pmtrace.maxoverhead*100./pmtrace.max,
-	   "max bytes", "function", "file");
+	   pmtrace.max, pmtrace.maxoverhead*100./pmtrace.max);
+  if (pmtrace.maxmapped)
+    fprintf (stderr,
+	     "*** MTRACE: max mapped memory size: %10ld bytes"
+	     " (memory pool regions)\n",
+	     pmtrace.maxmapped);
+  fprintf (stderr, "%10s    %20s   %s\n", "max bytes", "function", "file");
   qsort (pmfuncs, pmfuncn, sizeof(pmfunc), pmaxsort);
   pmfunc * p = pmfuncs;
   for (int i = 0; i < pmfuncn && p->max > 0; i++, p++)
@@ -391,11 +391,11 @@ void multigrid_debug (Point point)
   fclose (plot);
 }
 
-static void multigrid_restriction (scalar * list)
+static void multigrid_restriction_levels (scalar * list)
 {
   scalar * listdef = NULL, * listc = NULL, * list2 = NULL;
   for (scalar s in list) 
-    if (!is_constant (s) && s.block > 0) {
+    if (!is_constant (s) && s.block > 0 && !s.leafonly) {
       if (s.restriction == restriction_average) {
 	listdef = list_add (listdef, s);
 	list2 = list_add (list2, s);
@@ -429,6 +429,118 @@ static void multigrid_restriction (scalar * list)
   }
 }
 
+/**
+## Lazy restriction
+
+The same fields are often restricted several times per timestep even
+though they have not been modified in the meantime. For example the
+coefficients $\alpha$ and $\lambda$ are restricted by each call to
+[poisson()](/src/poisson.h#user-interface)
+i.e. by both projections of the [centered
+solver](/src/navier-stokes/centered.h).
+
+The `restriction_stamp` and `restriction_mesh` attributes record the
+[stamp](stencils.h) of the field (plus one, so that zero means
+"never restricted") and the stamp of the mesh when its coarse levels
+were last computed. Only the fields which have been modified since
+are restricted, together, within the same traversals of the
+levels.
+
+This is only used for the default restriction functions, which depend
+only on the values of the field itself. Fields whose boundary
+conditions have not been applied (in particular, fields which have
+been tagged `dirty` manually after having been modified outside a
+foreach loop) are also always restricted. */
+
+attribute {
+  long restriction_stamp, restriction_mesh;
+}
+
+struct {
+  long calls, fields, avoided;
+} restriction_stats = {0};
+
+static long restriction_mesh_stamp()
+{
+#if TREE
+  update_cache();
+  return tree->stamp;
+#else
+  return 0;
+#endif
+}
+
+static bool restriction_cached (scalar s)
+{
+  return !is_constant (s) && s.block == 1 && !s.leafonly &&
+    (s.restriction == restriction_average ||
+     s.restriction == restriction_face ||
+     s.restriction == restriction_vertex);
+}
+
+static bool restriction_valid (scalar s, long mesh)
+{
+  if (!restriction_cached (s))
+    return false;
+  if (s.face) {
+    vector v = s.v;
+    foreach_dimension()
+      if (v.x.dirty || v.x.restriction_stamp != v.x.stamp + 1 ||
+	  v.x.restriction_mesh != mesh)
+	return false;
+    return true;
+  }
+  return !s.dirty && s.restriction_stamp == s.stamp + 1 &&
+    s.restriction_mesh == mesh;
+}
+
+static void restriction_validate (scalar s, long mesh)
+{
+  if (s.face) {
+    vector v = s.v;
+    foreach_dimension()
+      v.x.restriction_stamp = v.x.stamp + 1, v.x.restriction_mesh = mesh;
+  }
+  else
+    s.restriction_stamp = s.stamp + 1, s.restriction_mesh = mesh;
+}
+
+/**
+The validity of the coarse levels must be the same on all processes
+since the restriction involves collective communications. */
+
+static void multigrid_restriction (scalar * list)
+{
+  long mesh = restriction_mesh_stamp();
+  int n = list_len (list), valid[n + 1], i = 0;
+  for (scalar s in list)
+    valid[i++] = restriction_valid (s, mesh);
+  mpi_all_reduce_array (valid, MPI_INT, MPI_MIN, n);
+  scalar * listr = NULL;
+  i = 0;
+  for (scalar s in list)
+    if (valid[i++])
+      restriction_stats.avoided++;
+    else
+      listr = list_add (listr, s);
+  if (listr) {
+    boundary (listr);
+    multigrid_restriction_levels (listr);
+    restriction_stats.calls++;
+    restriction_stats.fields += list_len (listr);
+    for (scalar s in listr)
+      if (restriction_cached (s))
+	restriction_validate (s, mesh);
+    free (listr);
+  }
+}
+
+static void multigrid_scalar_clone (scalar clone, scalar src)
+{
+  cartesian_scalar_clone (clone, src);
+  clone.restriction_stamp = 0;
+}
+
 void multigrid_methods()
 {
   cartesian_methods();
@@ -438,6 +550,7 @@ void multigrid_methods()
   init_face_vector   = multigrid_init_face_vector;
   init_tensor        = multigrid_init_tensor;
   restriction        = multigrid_restriction;
+  scalar_clone       = multigrid_scalar_clone;
   debug              = multigrid_debug;
 }
 
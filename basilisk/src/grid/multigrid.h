@@ -272,13 +272,27 @@ macro2 foreach (char flags = 0, Reduce reductions = None) {
     OMP(omp for schedule(static))
       for (_k = GHOSTS; _k < point.n.x + GHOSTS; _k++) {
 	point.i = _k;
-#if dimension > 1
-	for (point.j = GHOSTS; point.j < point.n.y + GHOSTS; point.j++)
-#if dimension > 2
-	  for (point.k = GHOSTS; point.k < point.n.z + GHOSTS; point.k++)
-#endif
-#endif
+#if dimension == 1
+	{...}
+#elif dimension == 2
+	Point _point = point;
+	OMP_SIMD (reductions)
+	for (int _l = GHOSTS; _l < point.n.y + GHOSTS; _l++) {
+	  Point point = _point; NOT_UNUSED (point);
+	  point.j = _l;
+	  {...}
+	}
+#else
+	for (point.j = GHOSTS; point.j < point.n.y + GHOSTS; point.j++) {
+	  Point _point = point;
+	  OMP_SIMD (reductions)
+	  for (int _m = GHOSTS; _m < point.n.z + GHOSTS; _m++) {
+	    Point point = _point; NOT_UNUSED (point);
+	    point.k = _m;
 	    {...}
+	  }
+	}
+#endif
       }
   }
 }
@@ -307,13 +321,27 @@ macro2 foreach_face_generic (char flags = 0, Reduce reductions = None,
     OMP(omp for schedule(static))
       for (_k = GHOSTS; _k <= point.n.x + GHOSTS; _k++) {
 	point.i = _k;
-#if dimension > 1
-	for (point.j = GHOSTS; point.j <= point.n.y + GHOSTS; point.j++)
-#if dimension > 2
-	  for (point.k = GHOSTS; point.k <= point.n.z + GHOSTS; point.k++)
-#endif
-#endif
+#if dimension == 1
+	{...}
+#elif dimension == 2
+	Point _point = point;
+	OMP_SIMD (reductions)
+	for (int _l = GHOSTS; _l <= point.n.y + GHOSTS; _l++) {
+	  Point point = _point; NOT_UNUSED (point);
+	  point.j = _l;
+	  {...}
+	}
+#else
+	for (point.j = GHOSTS; point.j <= point.n.y + GHOSTS; point.j++) {
+	  Point _point = point;
+	  OMP_SIMD (reductions)
+	  for (int _m = GHOSTS; _m <= point.n.z + GHOSTS; _m++) {
+	    Point point = _point; NOT_UNUSED (point);
+	    point.k = _m;
 	    {...}
+	  }
+	}
+#endif
       }
   }
 }
@@ -12,7 +12,19 @@ The resulting access pattern is stored in the `read` and `write`
 arrays associated with each field.
 
 The `dirty` attribute is used to store the status of boundary
-conditions for each field. */
+conditions for each field. The `stamp` attribute is incremented each
+time the field is write-accessed by a foreach loop. It can be used to
+check whether a field has been modified (see for example the
+[interface geometry cache](/src/fractions.h#cached-interface-geometry)).
+
+Fields with the `leafonly` attribute set (typically diagnostic fields)
+only have values on leaf cells: they are not restricted, prolongated
+or given boundary conditions and, on trees, they are not stored on
+the other cells (see [tree.h](tree.h#leaf-only-fields)). They can
+only be accessed with a stencil of width zero, in foreach() loops. The
+attribute should be set once, when the field is created, and the
+storage is only released by an explicit call to `tree_compact()`
+(when compiled with `-DTRIM_LEAFONLY=1`). */
 
 attribute {
   // fixme: use a structure
@@ -22,6 +34,8 @@ attribute {
   // 0: all conditions applied
   // 1: nothing applied
   // 2: boundary_face applied
+  long stamp; // number of write accesses
+  bool leafonly; // only the values on leaf cells are used
 }
 
 typedef struct _External External;
@@ -45,6 +59,7 @@ typedef struct {
   int first;          // is this the first time the loop is called?
   int face;           // the face component(s) being traversed
   bool vertex;        // is this a vertex traversal?
+  bool local;         // is this a point or region traversal?
   int parallel;       // is this a parallel loop? (0: no, 1: on CPU or GPU, 2: on CPU, 3: on GPU)
   scalar * listc;     // the scalar fields on which to apply boundary conditions
   vectorl listf;      // the face vector fields on which to apply (flux) boundary conditions
@@ -90,6 +105,30 @@ conditions (i.e. normal components on faces only) done by
 void boundary_internal (scalar * list, const char * fname, int line);
 void (* boundary_face)  (vectorl);
 
+/**
+Statistics on boundary conditions are stored in this structure:
+`calls` is the number of times boundary conditions were applied (each
+call traverses the grid and, in parallel, exchanges halos), `fields`
+is the total number of fields they were applied to and `avoided` is
+the number of fields explicitly passed to `boundary()` for which the
+update was skipped, because they were already up-to-date. */
+
+struct {
+  long calls, fields, avoided;
+} boundary_stats = {0};
+
+/**
+The memory traffic of foreach loops (excluding level, point and
+region traversals) is estimated using their stencils: `bytes`
+assumes that each field accessed by a loop is read and/or written
+once for each (leaf) cell. This is used for example by
+[perfs.h](/src/navier-stokes/perfs.h). */
+
+struct {
+  long loops;
+  double bytes;
+} stencil_stats = {0};
+
 /**
 This function is called after the stencil access detection, just
 before the (real) foreach loop is executed. This is where we use the
@@ -115,6 +154,31 @@ void check_stencil (ForeachData * loop)
       If the field is read and dirty, we need to check if boundary
       conditions need to be applied. */
       
+      if (read && s.leafonly && s.width > 0) {
+	fprintf (stderr,
+		 "%s:%d: error: leaf-only field '%s' cannot be accessed with"
+		 " a stencil wider than zero\n",
+		 loop->fname, loop->line, s.name);
+	exit (1);
+      }
+      if ((read || write) && s.leafonly && !s.face &&
+	  (loop->face || loop->vertex)) {
+	fprintf (stderr,
+		 "%s:%d: error: leaf-only field '%s' cannot be accessed in"
+		 " face or vertex loops\n",
+		 loop->fname, loop->line, s.name);
+	exit (1);
+      }
+#if TREE
+      if ((read || write) && !s.leafonly && leaf_stored (s)) {
+	fprintf (stderr,
+		 "%s:%d: error: the leafonly attribute of field '%s' was"
+		 " reset after calling tree_compact()\n",
+		 loop->fname, loop->line, s.name);
+	exit (1);
+      }
+#endif
+      
       if (read && scalar_is_dirty (s)) {
 
 	/**
@@ -249,6 +313,17 @@ void check_stencil (ForeachData * loop)
       }
     }
   }
+
+  /**
+  We update the estimated memory traffic. */
+
+  if (!loop->local) {
+    int n = 0;
+    for (scalar s in baseblock)
+      n += s.input + s.output;
+    stencil_stats.loops++;
+    stencil_stats.bytes += n*sizeof(real)*(double) grid->n;
+  }
 }
 
 /**
@@ -274,6 +349,7 @@ void boundary_stencil (ForeachData * loop)
     }
 #endif
     boundary_face (loop->listf);
+    boundary_stats.calls++;
     foreach_dimension()
       free (loop->listf.x), loop->listf.x = NULL;
   }
@@ -304,7 +380,7 @@ void boundary_stencil (ForeachData * loop)
     fputc ('\n', stderr);
 #endif
     for (scalar s in loop->dirty)
-      s.dirty = true;
+      s.dirty = true, s.stamp++;
     free (loop->dirty), loop->dirty = NULL;
   }
 }
@@ -364,14 +440,18 @@ macro2 foreach_level_or_leaf_stencil (int l, char flags, Reduce reductions) {
 
 macro2 foreach_point_stencil (double xp, double yp, double zp, char flags, Reduce reductions)
 {
-  foreach_stencil (flags, reductions)
+  foreach_stencil (flags, reductions) {
+    _loop.local = true;
     {...}
+  }
 }
 
 macro2 foreach_region_stencil (coord p, coord box[2], coord n, char flags, Reduce reductions)
 {
-  foreach_stencil (flags, reductions)
+  foreach_stencil (flags, reductions) {
+    _loop.local = true;
     {...}
+  }
 }
 
 macro2 _stencil_is_face_x (ForeachData l = _loop) { l.face |= (1 << 0); {...} }
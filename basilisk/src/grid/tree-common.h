@@ -54,17 +54,26 @@ int refine_cell (Point point, scalar * list, int flag, Cache * refined)
   /* update neighborhood */
   increment_neighbors (point);
 
+  /* the children become leaves */
+  if (is_trimmed (child(0)))
+    trim_children (point, false);
   int cflag = is_active(cell) ? (active|leaf) : leaf;
   foreach_child()
     cell.flags |= cflag;
     
   /* initialise scalars */
   for (scalar s in list)
-    if (is_local(cell) || s.face)
+    if (s.leafonly) {
+      if (is_local(cell))
+	refine_injection (point, s);
+    }
+    else if (is_local(cell) || s.face)
       s.refine (point, s);
 
   /* refine */
   cell.flags &= ~leaf;
+  if (_nleaf && level > 0 && !is_trimmed(cell) && !leaf_children (parent))
+    trim_children (parent, true);
 
 @if _MPI
   if (is_border(cell)) {
@@ -108,16 +117,29 @@ bool coarsen_cell (Point point, scalar * list)
       return false; // cannot coarsen
 #endif
 
+  /* the cell becomes a leaf */
+  if (is_trimmed(cell))
+    trim_children (parent, false);
+
   /* restriction/coarsening */
-  for (scalar s in list) {
-    s.restriction (point, s);
-    if (s.coarsen)
-      s.coarsen (point, s);
-  }
+  for (scalar s in list)
+    if (!s.leafonly) {
+      s.restriction (point, s);
+      if (s.coarsen)
+	s.coarsen (point, s);
+    }
     
   /* coarsen */
   cell.flags |= leaf;
 
+  /* leaf-only fields can only be set once the cell is a leaf */
+  for (scalar s in list)
+    if (s.leafonly) {
+      s.restriction (point, s);
+      if (s.coarsen)
+	s.coarsen (point, s);
+    }
+
   /* update neighborhood */
   decrement_neighbors (point);
   
@@ -177,6 +199,13 @@ astats adapt_wavelet (scalar * slist,       // list of scalars
 		      scalar * list = all)  // list of fields to update
 {
   scalar * ilist = list;
+
+  for (scalar s in slist)
+    if (s.leafonly) {
+      fprintf (stderr, "adapt_wavelet(): error: leaf-only field '%s' has no"
+	       " values on parent cells\n", s.name);
+      exit (1);
+    }
   
   if (is_constant(cm)) {
     if (list == NULL || list == all)
@@ -312,6 +341,9 @@ astats adapt_wavelet (scalar * slist,       // list of scalars
 
   if (list != ilist)
     free (list);
+
+  if (st.nc && tree_fragmentation() > tree_compact_threshold)
+    tree_compact();
   
   return st;
 }
@@ -625,6 +657,18 @@ static tensor tree_init_tensor (tensor t, const char * name)
 trace
 static void tree_boundary_level (scalar * list, int l)
 {
+  /* leaf-only fields have no values on ghost, parent or halo cells */
+  for (scalar s in list)
+    if (s.leafonly) {
+      scalar * listb = NULL;
+      for (scalar sb in list)
+	if (!sb.leafonly)
+	  listb = list_append (listb, sb);
+      tree_boundary_level (listb, l);
+      free (listb);
+      return;
+    }
+  
   int depth = l < 0 ? depth() : l;
 
   if (tree_is_full()) {
@@ -831,9 +875,10 @@ void tree_check()
 
 trace
 static void tree_restriction (scalar * list) {
-  boundary (list);
   if (tree_is_full())
     multigrid_restriction (list);
+  else
+    boundary (list);
 }
 
 void tree_methods()
@@ -57,7 +57,8 @@ enum {
   leaf      = 1 << 1,
   border    = 1 << 2,
   vertex    = 1 << 3,
-  user      = 4,
+  trimmed   = 1 << 4,
+  user      = 5,
 
   face_x = 1 << 0
 #if dimension >= 2
@@ -71,6 +72,7 @@ enum {
 @define is_active(cell)  ((cell).flags & active)
 @define is_leaf(cell)    ((cell).flags & leaf)
 @define is_coarse()      ((cell).neighbors > 0)
+@define is_trimmed(cell) ((cell).flags & trimmed)
 @define is_border(cell)  ((cell).flags & border)
 @define is_local(cell)   ((cell).pid == pid())
 @define is_vertex(cell)  ((cell).flags & vertex)
@@ -108,11 +110,58 @@ typedef struct {
   int n, nm;
 } Cache;
 
+/**
+## Leaf-only fields
+
+The record of each cell holds the values of all the fields. The
+values of the fields with the `leafonly` attribute (see
+[stencils.h](stencils.h#automatic-stencils-and-boundary-conditions))
+are only defined on leaf cells, so these fields are stored after all
+the other fields and the blocks of children which do not contain any
+leaf are *trimmed*, i.e. allocated without the slots of the leaf-only
+fields. This saves their storage on parent cells and on the halo and
+ghost cells.
+
+This storage is only used when compiling with `-DTRIM_LEAFONLY=1`
+since the slot of each field in the record is then given by the
+`_offset` table, i.e. each access to a field costs an extra load. In
+this case `_nleaf` is the number of fields stored as leaf-only and
+accessing (reading or writing) one of these fields on a cell which is
+not a leaf is an error. The layout is only updated by
+`tree_compact()`, which must thus be called after setting the
+`leafonly` attribute of existing fields. Only centered fields are
+stored as leaf-only (face and vertex values are stored on non-leaf
+cells) and leaf-only storage is disabled with MPI and multilayer
+fields. */
+
+int * _offset = NULL;
+static int _nleaf = 0;
+
+static inline bool leaf_storable (scalar s)
+{
+#if _MPI || LAYERS || !TRIM_LEAFONLY
+  return false;
+#else
+  return s.leafonly && !s.freed && !s.face && !is_vertex_scalar (s);
+#endif
+}
+
+static inline bool leaf_stored (scalar s)
+{
+  return _offset[s.i] >= (int) (datasize/sizeof(real)) - _nleaf;
+}
+
+static size_t record_size (bool trim)
+{
+  return sizeof(Cell) + datasize - (trim ? _nleaf*sizeof(real) : 0);
+}
+
 // Layer
 
 typedef struct {
   Memindex m; // the structure indexing the data
   Mempool * pool; // the memory pool actually holding the data
+  Mempool * tpool; // the memory pool of trimmed blocks (or NULL)
   long nc;     // the number of allocated elements
   int len;    // the (1D) size of the array
 } Layer;
@@ -134,17 +183,29 @@ static size_t poolsize (size_t depth, size_t size)
 #endif
 }
 
+static Mempool * layer_pool (int depth, bool trim)
+{
+  size_t size = record_size (trim);
+  // the block size is 2^dimension*size because we allocate
+  // 2^dimension children at a time
+  Mempool * m = mempool_new (poolsize (depth, size), (1 << dimension)*size);
+  // reading a leaf-only field on a trimmed cell stays within the pool
+  if (trim)
+    m->guard = _nleaf*sizeof(real);
+  return m;
+}
+
 static Layer * new_layer (int depth)
 {
   Layer * l = qmalloc (1, Layer);
   l->len = _size (depth);
+  l->tpool = NULL;
   if (depth == 0)
     l->pool = NULL; // the root layer does not use a pool
   else {
-    size_t size = sizeof(Cell) + datasize;
-    // the block size is 2^dimension*size because we allocate
-    // 2^dimension children at a time
-    l->pool = mempool_new (poolsize (depth, size), (1 << dimension)*size);
+    l->pool = layer_pool (depth, false);
+    if (_nleaf)
+      l->tpool = layer_pool (depth, true);
   }
   l->m = mem_new (l->len);
   l->nc = 0;
@@ -155,6 +216,8 @@ static void destroy_layer (Layer * l)
 {
   if (l->pool)
     mempool_destroy (l->pool);
+  if (l->tpool)
+    mempool_destroy (l->tpool);
   mem_destroy (l->m, l->len);
   free (l);
 }
@@ -176,6 +239,7 @@ typedef struct {
   CacheLevel * restriction;
   
   bool dirty;       /* whether caches should be updated */
+  long stamp;       /* number of updates of the caches */
 } Tree;
 
 #define tree ((Tree *)grid)
@@ -316,6 +380,29 @@ void cache_shrink (Cache * c)
 @define fine(a,k,p,n)   ((double *) (CHILD(k,p,n) + sizeof(Cell)))[_index(a,n)]
 @define coarse(a,k,p,n) ((double *) (PARENT(k,p,n) + sizeof(Cell)))[_index(a,n)]
 
+#if TRIM_LEAFONLY && !LAYERS
+static void leaf_only_error (scalar s)
+{
+  fprintf (stderr, "error: leaf-only field '%s' cannot be accessed"
+	   " on a non-leaf cell\n", s.name);
+  exit (1);
+}
+
+static inline int leaf_index (scalar s, const char * record)
+{
+  int i = _offset[s.i];
+  if (i >= (int) (datasize/sizeof(real)) - _nleaf &&
+      !(((const Cell *) record)->flags & leaf))
+    leaf_only_error (s);
+  return i;
+}
+
+@undef _index
+@define _index(a,m)     (_offset[(a).i])
+@undef val
+@define val(a,k,l,m)    data(k,l,m)[leaf_index (a, NEIGHBOR(k,l,m))]
+#endif
+
 macro POINT_VARIABLES (Point point = point) {
   VARIABLES();
   int level = point.level; NOT_UNUSED(level);
@@ -665,6 +752,7 @@ static void update_cache_f (void)
 }
   
   q->dirty = false;
+  q->stamp++;
 
 #if FBOUNDARY
   for (int l = depth(); l >= 0; l--)
@@ -767,7 +855,8 @@ void reset (void * alist, double val)
       for (scalar s in list) {
 	if (!is_constant(s))
 	  for (int b = 0; b < s.block; b++)
-	    data(0,0,0)[s.i + b] = val;
+	    if (!is_trimmed(cell) || !leaf_stored ((scalar){s.i + b}))
+	      data(0,0,0)[_offset[s.i + b]] = val;
       }
     }
   }
@@ -936,18 +1025,12 @@ static void free_periodic (Memindex m, int i, int j, int k, int len)
 }
 #endif // dimension == 3
 
-static void alloc_children (Point point)
+/* Assigns the records of block `b` (of record size `len`) to the
+   children of `point` */
+
+static void assign_children (Point point, char * b, size_t len)
 {
-  if (point.level == grid->depth)
-    update_depth (+1);
-  else if (allocated_child(0,0,0))
-    return;
-  
-  /* low-level memory management */
   Layer * L = tree->L[point.level + 1];
-  L->nc++;
-  size_t len = sizeof(Cell) + datasize;
-  char * b = (char *) mempool_alloc0 (L->pool);
   int i = 2*point.i - GHOSTS;
   for (int k = 0; k < 2; k++, i++) {
 #if dimension == 1
@@ -970,17 +1053,66 @@ static void alloc_children (Point point)
     }
 #endif
   }
+}
+
+/* The children of a `halo` cell are not leaves and their block is
+   trimmed. */
+
+static void alloc_children (Point point, bool halo = false)
+{
+  if (point.level == grid->depth)
+    update_depth (+1);
+  else if (allocated_child(0,0,0))
+    return;
+  
+  /* low-level memory management */
+  Layer * L = tree->L[point.level + 1];
+  L->nc++;
+  bool trim = halo && _nleaf;
+  assign_children (point, (char *) mempool_alloc0 (trim ? L->tpool : L->pool),
+		   record_size (trim));
   
   int pid = cell.pid;
   foreach_child() {
     cell.pid = pid;
+    if (trim)
+      cell.flags |= trimmed;
 @if TRASH
     for (scalar s in all)
-      s[] = undefined;
+      if (!trim || !leaf_stored (s))
+	data(0,0,0)[_index(s,0)] = undefined;
 @endif    
   }
 }
 
+/* Trims the block of children of `point` (or restores its full size
+   if `trim` is false). */
+
+static void trim_children (Point point, bool trim)
+{
+  Layer * L = tree->L[point.level + 1];
+  size_t len = record_size (trim), olen = record_size (!trim);
+  char * b = (char *) mempool_alloc0 (trim ? L->tpool : L->pool);
+  char * old = CHILD(0,0,0);
+  for (int k = 0; k < 1 << dimension; k++)
+    memcpy (b + k*len, old + k*olen, min (len, olen));
+  assign_children (point, b, len);
+  mempool_free (trim ? L->pool : L->tpool, old);
+  foreach_child()
+    if (trim)
+      cell.flags |= trimmed;
+    else
+      cell.flags &= ~trimmed;
+}
+
+static bool leaf_children (Point point)
+{
+  foreach_child()
+    if (is_leaf(cell))
+      return true;
+  return false;
+}
+
 #if dimension == 1 
 static void free_children (Point point)
 {
@@ -988,7 +1120,8 @@ static void free_children (Point point)
   Layer * L = tree->L[point.level + 1];
   int i = 2*point.i - GHOSTS;
   assert (mem_data (L->m,i));
-  mempool_free (L->pool, mem_data (L->m,i));
+  mempool_free (is_trimmed (child(0)) ? L->tpool : L->pool,
+		mem_data (L->m,i));
   for (int k = 0; k < 2; k++, i++)
     free_periodic (L->m, i, L->len);
   if (--L->nc == 0) {
@@ -1004,7 +1137,8 @@ static void free_children (Point point)
   Layer * L = tree->L[point.level + 1];
   int i = 2*point.i - GHOSTS, j = 2*point.j - GHOSTS;
   assert (mem_data (L->m,i,j));
-  mempool_free (L->pool, mem_data (L->m,i,j));
+  mempool_free (is_trimmed (child(0)) ? L->tpool : L->pool,
+		mem_data (L->m,i,j));
   for (int k = 0; k < 2; k++)
     for (int l = 0; l < 2; l++)
       free_periodic (L->m, i + k, j + l, L->len);
@@ -1021,8 +1155,8 @@ static void free_children (Point point)
   Layer * L = tree->L[point.level + 1];
   int i = 2*point.i - GHOSTS;
   assert (mem_data (L->m,i,2*point.j - GHOSTS,2*point.k - GHOSTS));
-  mempool_free (L->pool, mem_data (L->m,
-				   i,2*point.j - GHOSTS,2*point.k - GHOSTS));
+  mempool_free (is_trimmed (child(0)) ? L->tpool : L->pool,
+		mem_data (L->m, i,2*point.j - GHOSTS,2*point.k - GHOSTS));
   for (int k = 0; k < 2; k++, i++) {
     int j = 2*point.j - GHOSTS;
     for (int l = 0; l < 2; l++, j++) {
@@ -1046,7 +1180,7 @@ void increment_neighbors (Point point)
     alloc_children (point);
   foreach_neighbor (GHOSTS/2)
     if (cell.neighbors++ == 0)
-      alloc_children (point);
+      alloc_children (point, true);
   cell.neighbors--;
 }
 
@@ -1062,69 +1196,167 @@ void decrement_neighbors (Point point)
   if (cell.neighbors) {
     int pid = cell.pid;
     foreach_child() {
-      cell.flags = 0;
+      cell.flags &= trimmed;
       cell.pid = pid;
     }
+    if (_nleaf && !is_trimmed (child(0)))
+      trim_children (point, true);
   }
 }
 
-void realloc_scalar (int size)
+/**
+## Repacking
+
+The cell records are copied into new pools, in the (depth-first) order
+of the tree traversal, when fields are added or removed and when the
+leaf-only layout changes. The previous layout is given by the
+`from` offsets of `nfrom` fields, `nleaf` of which are leaf-only. */
+
+static void copy_record (char * dst, char * src, bool dtrim, bool strim,
+			 const int * from, int nfrom, int nleaf)
+{
+  int nvar = datasize/sizeof(real);
+  if (!nleaf && !_nleaf) // both layouts are the identity
+    memcpy (dst, src, sizeof(Cell) + min(nvar, nfrom)*sizeof(real));
+  else {
+    memcpy (dst, src, sizeof(Cell));
+    real * d = (real *) (dst + sizeof(Cell)), * s = (real *) (src + sizeof(Cell));
+    int nd = dtrim ? nvar - _nleaf : nvar, ns = strim ? nfrom - nleaf : nfrom;
+    for (int i = 0; i < nvar && i < nfrom; i++)
+      if (_offset[i] < nd)
+	d[_offset[i]] = from[i] < ns ? s[from[i]] : 0.;
+  }
+  if (dtrim)
+    CELL(dst).flags |= trimmed;
+  else
+    CELL(dst).flags &= ~trimmed;
+}
+
+static void repack_children (Point point, Mempool ** pools, Mempool ** tpools,
+			     const int * from, int nfrom, int nleaf)
+{
+  if (!allocated_child(0,0,0))
+    return;
+  bool strim = is_trimmed (child(0)), dtrim = _nleaf && !leaf_children (point);
+  size_t slen = sizeof(Cell) + (strim ? nfrom - nleaf : nfrom)*sizeof(real);
+  size_t dlen = record_size (dtrim);
+  char * b = (char *) mempool_alloc ((dtrim ? tpools : pools)[point.level + 1]);
+  char * old = CHILD(0,0,0);
+  for (int k = 0; k < 1 << dimension; k++)
+    copy_record (b + k*dlen, old + k*slen, dtrim, strim, from, nfrom, nleaf);
+  assign_children (point, b, dlen);
+  foreach_child()
+    repack_children (point, pools, tpools, from, nfrom, nleaf);
+}
+
+static void tree_repack (const int * from, int nfrom, int nleaf)
 {
-  /* low-level memory management */
-  Tree * q = tree;
-  size_t oldlen = sizeof(Cell) + datasize;
-  size_t newlen = oldlen + size;
-  datasize += size;
   /* the root level is allocated differently */
-  Layer * L = q->L[0];
+  Layer * L = tree->L[0];
+  size_t len = record_size (false);
   foreach_mem (L->m, L->len, 1) {
+    char * p = (char *) malloc (len);
 #if dimension == 1
-    char * p = (char *) realloc (mem_data (L->m, point.i), newlen*sizeof(char));
+    char * old = mem_data (L->m, point.i);
+    copy_record (p, old, false, false, from, nfrom, nleaf);
     assign_periodic (L->m, point.i, L->len, p);
 #elif dimension == 2
-    char * p = (char *) realloc (mem_data (L->m, point.i, point.j),
-				 newlen*sizeof(char));
+    char * old = mem_data (L->m, point.i, point.j);
+    copy_record (p, old, false, false, from, nfrom, nleaf);
     assign_periodic (L->m, point.i, point.j, L->len, p);
 #else
-    char * p = (char *) realloc (mem_data (L->m, point.i, point.j, point.k),
-				 newlen*sizeof(char));
+    char * old = mem_data (L->m, point.i, point.j, point.k);
+    copy_record (p, old, false, false, from, nfrom, nleaf);
     assign_periodic (L->m, point.i, point.j, point.k, L->len, p);
 #endif
+    free (old);
   }
+  
   /* all other levels */
+  Mempool * pools[depth() + 1], * tpools[depth() + 1];
   for (int l = 1; l <= depth(); l++) {
-    Layer * L = q->L[l];
-    Mempool * oldpool = L->pool;
-    L->pool = mempool_new (poolsize (l, newlen), (1 << dimension)*newlen);
-    foreach_mem (L->m, L->len, 2) {
-      char * new = (char *) mempool_alloc (L->pool);
-#if dimension == 1
-      for (int k = 0; k < 2; k++) {
-	memcpy (new, mem_data (L->m, point.i + k), oldlen);
-	assign_periodic (L->m, point.i + k, L->len, new);
-	new += newlen;
-      }
-#elif dimension == 2
-      for (int k = 0; k < 2; k++)
-	for (int o = 0; o < 2; o++) {
-	  memcpy (new, mem_data (L->m, point.i + k,point.j + o), oldlen);
-	  assign_periodic (L->m, point.i + k, point.j + o, L->len, new);
-	  new += newlen;
-	}
-#else // dimension == 3
-      for (int l = 0; l < 2; l++)
-	for (int m = 0; m < 2; m++)
-	  for (int n = 0; n < 2; n++) {
-	    memcpy (new, mem_data (L->m, point.i + l, point.j + m, point.k + n),
-		    oldlen);
-	    assign_periodic (L->m, point.i + l, point.j + m, point.k + n,
-				 L->len, new);
-	    new += newlen;
-	  }
-#endif // dimension == 3
+    pools[l] = layer_pool (l, false);
+    tpools[l] = _nleaf ? layer_pool (l, true) : NULL;
+  }
+  Point root = {0};
+  for (root.i = GHOSTS*Period.x; root.i <= GHOSTS*(2 - Period.x); root.i++)
+#if dimension >= 2
+    for (root.j = GHOSTS*Period.y; root.j <= GHOSTS*(2 - Period.y); root.j++)
+#endif
+#if dimension >= 3
+      for (root.k = GHOSTS*Period.z; root.k <= GHOSTS*(2 - Period.z); root.k++)
+#endif
+	repack_children (root, pools, tpools, from, nfrom, nleaf);
+  for (int l = 1; l <= depth(); l++) {
+    Layer * L = tree->L[l];
+    mempool_destroy (L->pool);
+    if (L->tpool)
+      mempool_destroy (L->tpool);
+    L->pool = pools[l], L->tpool = tpools[l];
+  }
+}
+
+/* Sets the layout of the current fields and returns the previous
+   offsets: the regular fields come first, then the leaf-only ones. */
+
+static int * new_layout()
+{
+  int * from = _offset, nvar = datasize/sizeof(real), n = 0;
+  _offset = (int *) malloc (max (nvar, 1)*sizeof(int));
+  _nleaf = 0;
+  for (int i = 0; i < nvar; i++)
+    if (!leaf_storable ((scalar){i}))
+      _offset[i] = n++;
+  for (int i = 0; i < nvar; i++)
+    if (leaf_storable ((scalar){i}))
+      _offset[i] = n++, _nleaf++;
+  return from;
+}
+
+void realloc_scalar (int size)
+{
+  int nfrom = datasize/sizeof(real), nleaf = _nleaf;
+  datasize += size;
+  int * from = new_layout();
+  tree_repack (from, nfrom, nleaf);
+  free (from);
+}
+
+/**
+## Compaction
+
+The blocks of children freed by coarsening are kept in the free lists
+of the memory pools of each level, so that memory usage stays at its
+peak and the remaining cells are scattered across partly-empty
+pools. The `tree_compact()` function repacks the tree, which releases
+the old pools. It also applies the current leaf-only layout. */
+
+void tree_compact()
+{
+  int nfrom = datasize/sizeof(real), nleaf = _nleaf, * from = new_layout();
+  tree_repack (from, nfrom, nleaf);
+  free (from);
+}
+
+/**
+The fraction of the memory of the pools which would be released by
+compaction is returned by `tree_fragmentation()`. If it is larger
+than `tree_compact_threshold`, `adapt_wavelet()` calls
+`tree_compact()` automatically. */
+
+double tree_compact_threshold = 1.; // i.e. never
+
+double tree_fragmentation()
+{
+  double excess = 0., total = 0.;
+  for (int l = 1; l <= depth(); l++) {
+    Mempool * m[2] = {tree->L[l]->pool, tree->L[l]->tpool};
+    for (int i = 0; i < 2 && m[i]; i++) {
+      excess += mempool_excess (m[i])*(double) m[i]->poolsize;
+      total += m[i]->np*(double) m[i]->poolsize;
     }
-    mempool_destroy (oldpool);
   }
+  return total > 0. ? excess/total : 0.;
 }
 
 /* Boundaries */
@@ -1444,6 +1676,8 @@ macro mask (double func) {
       cell.pid = pid;
       if (pid < 0) {
 	/* fixme: call coarsen_cell()? */
+	if (is_trimmed(cell))
+	  trim_children (parent, false);
 	cell.flags |= leaf;
 	decrement_neighbors (point);
       }
@@ -1491,6 +1725,9 @@ void free_grid (void)
   free_cache (q->restriction);
   free (q);
   grid = NULL;
+  free (_offset);
+  _offset = NULL;
+  _nleaf = 0;
 }
 
 static void refine_level (int depth);
@@ -1502,6 +1739,11 @@ void init_grid (int n)
   assert (sizeof(Cell) % 8 == 0);
   
   free_grid();
+  // the initial layout is the identity
+  int nvar = datasize/sizeof(real);
+  _offset = (int *) malloc (max (nvar, 1)*sizeof(int));
+  for (int i = 0; i < nvar; i++)
+    _offset[i] = i;
   int depth = 0;
   while (n > 1) {
     if (n % 2) {
@@ -219,18 +219,23 @@ require such high stencils to compute consistent HF curvatures. We do
 this by selecting the smallest height in a 5-cells neighborhood along
 each direction. */
 
+static inline void column_propagation_point (Point point, vector h)
+{
+  for (int i = -2; i <= 2; i++)
+    foreach_dimension()
+      if (fabs(height(h.x[i])) <= 3.5 &&
+	  fabs(height(h.x[i]) + i) < fabs(height(h.x[])))
+	h.x[] = h.x[i] + i;
+}
+
 static void column_propagation (vector h)
 {
-#if _OPENMP 
-  foreach (serial) // not compatible with OpenMP
+#if _OPENMP || SIMD
+  foreach (serial) // not compatible with OpenMP or SIMD loops
 #else
   foreach()
 #endif
-    for (int i = -2; i <= 2; i++)
-      foreach_dimension()
-	if (fabs(height(h.x[i])) <= 3.5 &&
-	    fabs(height(h.x[i]) + i) < fabs(height(h.x[])))
-	  h.x[] = h.x[i] + i;
+    column_propagation_point (point, h);
 }
 
 /**
@@ -355,6 +360,128 @@ static void refine_h_x (Point point, scalar h)
 #endif // dimension == 3
 }
 
+/**
+### Interfacial band
+
+The heights are undefined (*nodata*) in cells farther than four cells
+(along each direction) from a "seed" cell i.e. a cell which is
+interfacial, or whose volume fraction differs from that of one of its
+neighbors, or which is next to a non-active, remote or boundary cell
+(whose shifted volume fraction is obtained using boundary
+conditions). After propagation, the heights are also undefined farther
+than six cells from a seed cell.
+
+When `heights_band` is set, the half-column integrations and the
+column propagation are only performed within this band. This gives
+identical results but building the band has a cost which is only
+recovered on large levels which are mostly far from the interface
+(e.g. thin interfaces on uniform or weakly-refined meshes), so that
+this option is not the default. */
+
+bool heights_band = false;
+
+macro2 foreach_cache_level_serial (CacheLevel cache, int _l)
+{
+  {
+    int ig = 0, jg = 0, kg = 0; NOT_UNUSED(ig); NOT_UNUSED(jg); NOT_UNUSED(kg);
+    Point point = {0}; NOT_UNUSED (point);
+    point.level = _l;
+    for (int _k = 0; _k < cache.n; _k++) {
+      point.i = cache.p[_k].i;
+#if dimension >= 2
+      point.j = cache.p[_k].j;
+#endif
+#if dimension >= 3
+      point.k = cache.p[_k].k;
+#endif
+      {...}
+    }
+  }
+}
+
+#define heights_cell(i) (allocated(i) && is_local(neighbor(i)) &&	\
+		      is_active(neighbor(i)))
+
+/**
+This function initialises the heights with *nodata* and returns, for
+each level, the list of active cells within six cells of a seed
+cell. Field *b* is set to the number of (two-cells-wide) dilations
+necessary to reach the cell. */
+
+static CacheLevel * heights_band_new (scalar c, vector h, scalar b)
+{
+  CacheLevel * band = qcalloc (depth() + 1, CacheLevel), front = {0}, next = {0};
+  for (int l = 1; l <= depth(); l++) {
+    foreach_level (l) {
+      foreach_dimension()
+	h.x[] = nodata;
+      b[] = nodata;
+      if (c[] > 0. && c[] < 1.)
+	b[] = 0;
+      else
+	foreach_dimension()
+	  if (c[-1] != c[] || c[1] != c[]
+#if _MPI
+	      || !heights_cell(-1) || !heights_cell(1)
+#endif
+	      )
+	    b[] = 0;
+    }
+
+    /**
+    The active neighbors of prolongation and boundary cells are also
+    seeds. */
+    
+    CacheLevel edges[2] = {tree->prolongation[l], tree->boundary[l]};
+    for (int e = 0; e < 2; e++)
+      foreach_cache_level_serial (edges[e], l)
+	foreach_dimension()
+	  for (int i = -1; i <= 1; i += 2)
+	    if (heights_cell(i))
+	      b[i] = 0;
+    
+    front.n = 0;
+    foreach_cache_level_serial (tree->active[l], l)
+      if (b[] == 0)
+	cache_level_append (&front, point);
+
+    /**
+    If the band covers more than half of the active cells, it is
+    cheaper to use all the cells of this level, which is indicated
+    by a negative band size. */
+    
+    int n = front.n;
+    for (int r = 1; r <= 3 && 2*n <= tree->active[l].n; r++) {
+      next.n = 0;
+      foreach_cache_level_serial (front, l)
+	foreach_dimension()
+	  for (int i = -2; i <= 2; i++)
+	    if (i != 0 && heights_cell(i) && b[i] == nodata) {
+	      b[i] = r;
+	      cache_level_append (&next, neighborp(i));
+	    }
+      CacheLevel tmp = front; front = next; next = tmp;
+      n += front.n;
+    }
+    if (2*n > tree->active[l].n) {
+      band[l].n = -1;
+      continue;
+    }
+
+    /**
+    The band is stored in the order of the active cells, which is also
+    the order used by `foreach()` for the column propagation. */
+    
+    foreach_cache_level_serial (tree->active[l], l)
+      if (b[] != nodata)
+	cache_level_append (&band[l], point);
+  }
+  free (front.p), free (next.p);
+  return band;
+}
+
+#undef heights_cell
+
 /**
 The *heights()* function implementation is similar to the multigrid
 case, but the construction of the shifted volume fraction field *cs*
@@ -373,6 +500,17 @@ void heights (scalar c, vector h)
   fraction on all levels. */
   
   restriction ({c});
+
+  /**
+  The band (and the field *b* it uses) is only built when requested,
+  so that the default does not allocate an extra field. */
+  
+  scalar b = {-1};
+  CacheLevel * band = NULL;
+  if (heights_band) {
+    b = new scalar;
+    band = heights_band_new (c, h, b);
+  }
   for (int j = -1; j <= 1; j += 2) {
 
     /**
@@ -387,10 +525,15 @@ void heights (scalar c, vector h)
 
       /**
       We construct the ($\pm 2$) shifted field at this level. */
-      
-      foreach_level (l)
-	foreach_dimension()
-	  s.x[] = c[2*j];
+
+      if (band && band[l].n >= 0)
+	foreach_cache_level (band[l], l)
+	  foreach_dimension()
+	    s.x[] = c[2*j];
+      else
+	foreach_level (l)
+	  foreach_dimension()
+	    s.x[] = c[2*j];
 
       /**
       We then need to apply boundary conditions on the shifted
@@ -420,8 +563,14 @@ void heights (scalar c, vector h)
       We can now sum the half-column at this level, downward or upward
       according to *j*. */
 
-      foreach_level (l)
-        half_column (point, c, h, s, j);
+      if (band && band[l].n >= 0)
+	foreach_cache_level (band[l], l) {
+	  if (b[] <= 2)
+	    half_column (point, c, h, s, j);
+	}
+      else
+	foreach_level (l)
+	  half_column (point, c, h, s, j);
     }
   }
     
@@ -438,8 +587,29 @@ void heights (scalar c, vector h)
 
   /**
   Finally, we "propagate" values along columns. */
-  
-  column_propagation (h);
+
+  if (band) {
+    boundary ((scalar *){h});
+    for (int l = 1; l <= depth(); l++) {
+      if (band[l].n >= 0)
+	foreach_cache_level_serial (band[l], l) {
+	  if (is_leaf(cell))
+	    column_propagation_point (point, h);
+	}
+      else
+	foreach_cache_level_serial (tree->active[l], l) {
+	  if (is_leaf(cell))
+	    column_propagation_point (point, h);
+	}
+      free (band[l].p);
+    }
+    free (band);
+    delete ({b});
+    foreach_dimension()
+      h.x.dirty = true, h.x.stamp++;
+  }
+  else
+    column_propagation (h);
   
   /**
   Final prolongation cells will be filled with values obtained either
@@ -2,19 +2,146 @@
 # Performance monitoring (for the Navier--Stokes solvers)
 
 This logs simple statistics available for the various [Navier--Stokes
-solvers](/src/README#navierstokes). */
+solvers](/src/README#navierstokes).
+
+## Cost accounting
+
+The following statistics are also logged, to help size production
+runs and spot performance regressions:
+
+* the number of cells by category (in addition to the number of
+  leaves `grid->tn`): the halo cells used for prolongation and the
+  ghost cells used for boundary conditions (both summed over all
+  levels) and, when using [VOF](/src/vof.h), the interfacial cells
+  (i.e. cells with a volume fraction strictly between zero and one),
+* the multigrid work per timestep i.e. the number of relaxed cells,
+  summed over all levels (see [poisson.h](/src/poisson.h#multigrid-cycle)),
+* the memory traffic per timestep, as estimated from the field
+  accesses of each foreach loop (see [stencils.h](/src/grid/stencils.h)),
+  the corresponding bandwidth (in GB/s) and the "roofline" efficiency
+  i.e. the ratio of this bandwidth to the peak memory bandwidth
+  `perfs_bandwidth`.
+
+The peak bandwidth (in GB/s, per process) can be set by the user. If
+it is not, it is measured at startup, using a
+[STREAM](https://www.cs.virginia.edu/stream/)-like "triad" loop.
+
+Note that the memory traffic estimate ignores caches and multigrid
+levels: the efficiency is only an indication of how close the solver
+is to being limited by memory bandwidth. */
+
+double perfs_bandwidth = 0.;
+
+static double perfs_triad()
+{
+  long n = 1 << 22;
+  double * a = malloc (3*n*sizeof(double)), * b = a + n, * c = b + n;
+  for (long j = 0; j < n; j++)
+    a[j] = 0., b[j] = 1., c[j] = 2.;
+  double best = 0.;
+  for (int k = 0; k < 4; k++) {
+    timer t = timer_start();
+    for (long j = 0; j < n; j++)
+      a[j] = b[j] + 3.*c[j];
+    double dt = timer_elapsed (t);
+    if (dt > 0. && 3.*n*sizeof(double)/dt > best)
+      best = 3.*n*sizeof(double)/dt;
+  }
+  if (a[n/2] != 7.)
+    best = 0.;
+  free (a);
+  return best/1e9;
+}
+
+static void perfs_cells (long * halo, long * ghost, long * interfacial)
+{
+  *halo = *ghost = *interfacial = 0;
+#if TREE
+  update_cache();
+  for (int l = 0; l <= depth(); l++)
+    *halo += tree->prolongation[l].n, *ghost += tree->boundary[l].n;
+#else // multigrid: square boxes are assumed
+  for (int l = 0; l <= depth(); l++) {
+    long n = grid->n >> dimension*(depth() - l);
+    double side = pow (n, 1./dimension);
+    *ghost += pow (side + 2*GHOSTS, dimension) - n;
+  }
+#endif
+#if VOF
+  long n = 0;
+  foreach (reduction(+:n))
+    for (scalar c in interfaces)
+      if (c[] > 1e-6 && c[] < 1. - 1e-6)
+	n++;
+  *interfacial = n;
+#endif
+  mpi_all_reduce (*halo, MPI_LONG, MPI_SUM);
+  mpi_all_reduce (*ghost, MPI_LONG, MPI_SUM);
+}
 
 event perfs (i += 1) {
   static FILE * fp = fopen ("perfs", "w");
-  if (i == 0)
+  if (i == 0) {
     fprintf (fp,
 	     "t dt mgp.i mgp.nrelax mgpf.i mgpf.nrelax mgu.i mgu.nrelax "
-	     "grid->tn perf.t perf.speed npe perf.ispeed\n");
-  static double start = 0.;
+	     "grid->tn perf.t perf.speed npe perf.ispeed "
+	     "halo ghost interfacial mg.work bytes GB/s efficiency\n");
+    if (!perfs_bandwidth) {
+      perfs_bandwidth = perfs_triad();
+      mpi_all_reduce (perfs_bandwidth, MPI_DOUBLE, MPI_MIN);
+    }
+  }
+  static double start = 0., bytes0 = 0.;
+  static long work0 = 0, i0 = 0;
   if (i > 10 && perf.t - start < 1.) return 0;
-  fprintf (fp, "%g %g %d %d %d %d %d %d %ld %g %g %d %g\n", 
+  long halo, ghost, interfacial;
+  perfs_cells (&halo, &ghost, &interfacial);
+  double bytes = stencil_stats.bytes - bytes0,
+    work = mg_relaxations - work0;
+  mpi_all_reduce (bytes, MPI_DOUBLE, MPI_SUM);
+  mpi_all_reduce (work, MPI_DOUBLE, MPI_SUM);
+  int steps = max (i - i0, 1);
+  double bandwidth = perf.t > start ? bytes/npe()/(perf.t - start)/1e9 : 0.;
+  fprintf (fp, "%g %g %d %d %d %d %d %d %ld %g %g %d %g "
+	   "%ld %ld %ld %g %g %g %g\n", 
 	   t, dt, mgp.i, mgp.nrelax, mgpf.i, mgpf.nrelax, mgu.i, mgu.nrelax,
-	   grid->tn, perf.t, perf.speed, npe(), perf.ispeed);
+	   grid->tn, perf.t, perf.speed, npe(), perf.ispeed,
+	   halo, ghost, interfacial, work/steps, bytes/steps, bandwidth,
+	   perfs_bandwidth > 0. ? bandwidth/perfs_bandwidth : 0.);
+  fflush (fp);
+  start = perf.t, bytes0 = stencil_stats.bytes, work0 = mg_relaxations;
+  i0 = i;
+}
+
+/**
+The (wall-clock) time spent in each event since the last output is
+written in the `perfs-events` file, one column per event. This can be
+displayed using for example
+
+~~~bash
+gnuplot> set key autotitle columnhead
+gnuplot> plot for [i=2:*] 'perfs-events' u 1:i w l
+~~~
+*/
+
+event perfs_events (i += 1) {
+  static FILE * fp = fopen ("perfs-events", "w");
+  if (i == 0) {
+    fputs ("t", fp);
+    for (Event * ev = Events; !ev->last; ev++)
+      fprintf (fp, " %s", ev->name);
+    fputc ('\n', fp);
+  }
+  static double start = 0.;
+  if (i > 10 && perf.t - start < 1.) return 0;
+  fprintf (fp, "%g", t);
+  for (Event * ev = Events; !ev->last; ev++) {
+    double cost = 0.;
+    for (Event * e = ev; e; e = e->next)
+      cost += e->cost, e->cost = 0.;
+    fprintf (fp, " %g", cost);
+  }
+  fputc ('\n', fp);
   fflush (fp);
   start = perf.t;
 }
@@ -9,7 +9,7 @@ mpl_height = 3.0 #inch  height of individual plots
 mpl_width  = 3.0 #inch  width of individual plots
 mpl_dx     = 0.2 #inch  inter-plot horizontal spacing
 mpl_dy     = 0.4 #inch  inter-plot vertical spacing
-mpl_ny     = 5   #number of rows
+mpl_ny     = 7   #number of rows
 mpl_nx     = 2   #number of columns
 
 # calculate full dimensions
@@ -40,6 +40,67 @@ EVERY = ceil(STATS_records/200.)
 unset key
 set style fill solid
 
+#-----------------------------------------------
+# subplot  1-6
+#  set horizontal margins for first column
+set lmargin at screen left(1)
+set rmargin at screen right(1)
+#  set horizontal margins for seventh row (top)
+set tmargin at screen top(7)
+set bmargin at screen bot(7)
+
+set ylabel 'halo, ghost / leaves'
+plot [][0:]'perfs' u 1:(($14+$15)/$9) every EVERY w boxes lc 0
+
+#-----------------------------------------------
+# subplot  2-6
+#  set horizontal margins for second column
+set lmargin at screen left(2)
+set rmargin at screen right(2)
+#  set horizontal margins for seventh row (top)
+set tmargin at screen top(7)
+set bmargin at screen bot(7)
+
+unset ytics
+set y2tics auto
+unset ylabel
+set y2label 'mg.work/leaves'
+plot [][0:]'perfs' u 1:($17/$9) every EVERY w boxes lc 0
+
+#-----------------------------------------------
+# subplot  1-5
+#  set horizontal margins for first column
+set lmargin at screen left(1)
+set rmargin at screen right(1)
+#  set horizontal margins for sixth row
+set tmargin at screen top(6)
+set bmargin at screen bot(6)
+
+unset y2label
+set ytics auto
+unset y2tics
+set ylabel 'GB/s'
+plot [][0:]'perfs' u 1:19 every EVERY w boxes lc 0
+
+#-----------------------------------------------
+# subplot  2-5
+#  set horizontal margins for second column
+set lmargin at screen left(2)
+set rmargin at screen right(2)
+#  set horizontal margins for sixth row
+set tmargin at screen top(6)
+set bmargin at screen bot(6)
+
+unset ytics
+set y2tics auto
+unset ylabel
+set y2label 'roofline efficiency'
+plot [][0:]'perfs' u 1:20 every EVERY w boxes lc 0
+
+unset y2label
+set ytics auto
+unset y2tics
+
 #-----------------------------------------------
 # subplot  1-4
 #  set horizontal margins for first column
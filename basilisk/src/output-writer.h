@@ -0,0 +1,150 @@
+/**
+# Background output writer
+
+Writing large files (snapshots, images) can take a significant
+fraction of the runtime. If *output_async* is set to true, the
+outputs which support it (see [dump()](output.h#dump-basilisk-snapshots)
+and the [PNG encoder](png-encoder.h)) only make an in-memory copy of
+the data and return, while the data is encoded and written to disk by
+a background thread. The jobs are executed in the order in which they
+were submitted, by a single thread, in order not to compete with the
+(OpenMP) threads of the solver. At most *OUTPUT_QUEUE* jobs can be
+waiting to be written, beyond that new outputs block.
+
+An asynchronous output is thus not on disk when the function
+returns, but only once *output_flush()* has been called. This
+function waits until all the pending outputs have been written. It is
+called automatically before restoring a snapshot, at the end of the
+simulation and when the program exits (including through `exit()`).
+
+The writer uses POSIX threads which are only part of the C library
+for recent versions of glibc (and on macOS), or when OpenMP is
+used. Otherwise (or when tracing memory allocations without OpenMP)
+the outputs are always written synchronously. */
+
+#include <pthread.h>
+
+bool output_async = false;
+
+#define OUTPUT_QUEUE 8
+
+/**
+A job is a structure starting with an *OutputJob*, whose *write()*
+function writes the data and frees the job. */
+
+typedef struct _OutputJob OutputJob;
+
+struct _OutputJob {
+  void (* write) (OutputJob * job, bool parallel);
+  OutputJob * next;
+};
+
+@if _OPENMP || __APPLE__ || __GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 34)
+
+static struct {
+  pthread_t thread;
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+  OutputJob * head, * tail;
+  int pending;
+  bool running, stop;
+} output_writer = {.mutex = PTHREAD_MUTEX_INITIALIZER,
+		   .cond = PTHREAD_COND_INITIALIZER};
+
+static void * output_writer_loop (void * arg)
+{
+  pthread_mutex_lock (&output_writer.mutex);
+  while (true) {
+    while (!output_writer.head && !output_writer.stop)
+      pthread_cond_wait (&output_writer.cond, &output_writer.mutex);
+    OutputJob * job = output_writer.head;
+    if (!job)
+      break;
+    output_writer.head = job->next;
+    if (!output_writer.head)
+      output_writer.tail = NULL;
+    pthread_mutex_unlock (&output_writer.mutex);
+    job->write (job, false);
+    pthread_mutex_lock (&output_writer.mutex);
+    output_writer.pending--;
+    pthread_cond_broadcast (&output_writer.cond);
+  }
+  pthread_mutex_unlock (&output_writer.mutex);
+  return NULL;
+}
+
+void output_flush()
+{
+  pthread_mutex_lock (&output_writer.mutex);
+  while (output_writer.pending > 0)
+    pthread_cond_wait (&output_writer.cond, &output_writer.mutex);
+  pthread_mutex_unlock (&output_writer.mutex);
+}
+
+static void output_writer_stop()
+{
+  if (!output_writer.running ||
+      pthread_equal (pthread_self(), output_writer.thread)) // exit() in a job
+    return;
+  pthread_mutex_lock (&output_writer.mutex);
+  output_writer.stop = true;
+  pthread_cond_broadcast (&output_writer.cond);
+  pthread_mutex_unlock (&output_writer.mutex);
+  pthread_join (output_writer.thread, NULL);
+  output_writer.running = output_writer.stop = false;
+}
+
+static bool output_writer_push (OutputJob * job)
+{
+  if (!output_writer.running) {
+    if (pthread_create (&output_writer.thread, NULL, output_writer_loop, NULL))
+      return false;
+    output_writer.running = true;
+    free_solver_func_add (output_writer_stop);
+    static bool registered = false;
+    if (!registered) {
+      atexit (output_writer_stop);
+      registered = true;
+    }
+  }
+  pthread_mutex_lock (&output_writer.mutex);
+  while (output_writer.pending >= OUTPUT_QUEUE)
+    pthread_cond_wait (&output_writer.cond, &output_writer.mutex);
+  job->next = NULL;
+  if (output_writer.tail)
+    output_writer.tail->next = job;
+  else
+    output_writer.head = job;
+  output_writer.tail = job;
+  output_writer.pending++;
+  pthread_cond_broadcast (&output_writer.cond);
+  pthread_mutex_unlock (&output_writer.mutex);
+  return true;
+}
+
+@else // no POSIX threads
+
+void output_flush() {}
+
+static bool output_writer_push (OutputJob * job)
+{
+  return false;
+}
+
+@endif // no POSIX threads
+
+/**
+This function writes *job* in the background if *output_async* is
+set (and possible), or immediately otherwise. */
+
+void output_submit (OutputJob * job)
+{
+#if MTRACE && !_OPENMP
+  // memory tracing is only thread-safe with OpenMP
+  bool async = false;
+#else
+  bool async = output_async;
+#endif
+  if (!async || !output_writer_push (job))
+    job->write (job, true);
+}
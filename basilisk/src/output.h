@@ -340,7 +340,14 @@ animations.
 The functions check whether the 'ffmpeg' or 'convert' executables are
 accessible, if they are not the conversion is disabled and the raw PPM
 images are saved. An extra ".ppm" extension is added to the file name
-to indicate that this happened. */
+to indicate that this happened.
+
+PNG images do not need 'convert': they are written in memory and
+encoded using the [built-in encoder](png-encoder.h), which can also
+write them in the background (see [*output_async*](output-writer.h)). 'convert' is only
+used if *options* are given. */
+
+#include "png-encoder.h"
 
 static const char * extension (const char * file, const char * ext) {
   int len = strlen(file);
@@ -383,6 +390,43 @@ static FILE * open_image_lookup (const char * file)
   return NULL;
 }
 
+typedef struct _ImageBuffer ImageBuffer;
+
+struct _ImageBuffer {
+  FILE * fp;
+  char * buf;
+  size_t len;
+  ImageBuffer * next;
+};
+
+static ImageBuffer * image_buffers = NULL;
+
+static FILE * open_image_buffer()
+{
+  ImageBuffer * b = malloc (sizeof (ImageBuffer));
+  b->buf = NULL, b->len = 0;
+  if (!(b->fp = open_memstream (&b->buf, &b->len))) {
+    free (b);
+    return NULL;
+  }
+  b->next = image_buffers, image_buffers = b;
+  return b->fp;
+}
+
+static bool close_image_buffer (const char * file, FILE * fp)
+{
+  for (ImageBuffer ** i = &image_buffers; *i; i = &(*i)->next)
+    if ((*i)->fp == fp) {
+      ImageBuffer * b = *i;
+      *i = b->next;
+      fclose (fp);
+      png_save_ppm (file, b->buf, b->len);
+      free (b);
+      return true;
+    }
+  return false;
+}
+
 static bool which (const char * command)
 {
   char * s = getenv ("PATH");
@@ -473,6 +517,12 @@ FILE * open_image (const char * file, const char * options)
     return open_image_data.fp[open_image_data.n - 1] = popen (command, "w");
   }
   else { // !animation
+    if (extension (file, ".png") && !(options && which ("convert"))) {
+      FILE * fp = open_image_buffer();
+      if (fp)
+	return fp;
+    }
+
     static int has_convert = -1;
     if (has_convert < 0) {
       if (which ("convert"))
@@ -505,6 +555,8 @@ FILE * open_image (const char * file, const char * options)
 void close_image (const char * file, FILE * fp)
 {
   assert (pid() == 0);
+  if (close_image_buffer (file, fp))
+    return;
   if (is_animation (file)) {
     if (!open_image_lookup (file))
       fclose (fp);
@@ -523,9 +575,9 @@ void close_image (const char * file, FILE * fp)
 Given a field, this function outputs a colormaped representation as a
 [Portable PixMap](http://en.wikipedia.org/wiki/Netpbm_format) image.
 
-If [ImageMagick](http://www.imagemagick.org/) is installed on the
-system, this image can optionally be converted to any image format
-supported by ImageMagick.
+This image can optionally be written in PNG format or, if
+[ImageMagick](http://www.imagemagick.org/) is installed on the
+system, converted to any image format supported by ImageMagick.
 
 The arguments and their default values are:
 
@@ -548,7 +600,7 @@ output_ppm (f, file = "f.png");
 ~~~
 
 to get a [PNG](http://en.wikipedia.org/wiki/Portable_Network_Graphics)
-image.
+image (this does not require ImageMagick).
 
 *min, max*
 : minimum and maximum values used to define the
@@ -590,6 +642,85 @@ with *file*).
 : write a checksum of the generated image in the file pointed.
 */
 
+/**
+The root process writes its pixels directly into the image. The
+other processes store their pixels as vertical runs of consecutive
+pixels, which are then gathered on the root process. */
+
+typedef struct {
+  int i, j, len;
+} PpmRun;
+
+typedef struct {
+  Color ** ppm;           // the image (on the root process)
+  int height;
+  Array * runs, * colors; // the pixels of the other processes
+} PpmImage;
+
+static inline void ppm_add_pixel (PpmImage * image, int i, int j, Color c)
+{
+  if (image->ppm) {
+    image->ppm[image->height - 1 - j][i] = c;
+    return;
+  }
+  Array * runs = image->runs, * colors = image->colors;
+  PpmRun * r = runs->len ? (PpmRun *)((char *) runs->p + runs->len) - 1 : NULL;
+  if (r && r->i == i && r->j + r->len == j)
+    r->len++;
+  else {
+    PpmRun n = {i, j, 1};
+    array_append (runs, &n, sizeof (PpmRun));
+  }
+  if (colors->len + sizeof (Color) >= colors->max) { // grow geometrically
+    colors->max = 2*colors->max + 4096;
+    colors->p = realloc (colors->p, colors->max);
+  }
+  array_append (colors, &c, sizeof (Color));
+}
+
+static inline Color ppm_color (Point point, scalar f, scalar mask, bool linear, coord p,
+			double cmap[NCMAP][3], double min, double max)
+{
+  double v;
+  if (mask.i >= 0) { // masking
+    if (linear) {
+      double m = interpolate_linear (point, mask, p.x, p.y, p.z);
+      if (m < 0.)
+	v = nodata;
+      else
+	v = interpolate_linear (point, f, p.x, p.y, p.z);
+    }
+    else {
+      if (mask[] < 0.)
+	v = nodata;
+      else
+	v = f[];
+    }
+  }
+  else if (linear)
+    v = interpolate_linear (point, f, p.x, p.y, p.z);
+  else
+    v = f[];
+  return colormap_color (cmap, v, min, max);
+}
+
+/**
+Whether the pixel centered on *p* is within the cell, using the same
+criterion as the pixel loop, i.e. *locate()*. */
+
+static bool ppm_in_cell (Point point, coord p)
+{
+  Point q = locate (p.x, p.y, p.z);
+  return q.level == point.level && q.i == point.i
+#if dimension >= 2
+    && q.j == point.j
+#endif
+#if dimension >= 3
+    && q.k == point.k
+#endif
+    ;
+}
+
 trace
 void output_ppm (scalar f,
 		 FILE * fp = stdout,
@@ -622,46 +753,103 @@ void output_ppm (scalar f,
   cn.y = (int)((box[1].y - box[0].y)/delta);
   if (((int)cn.y) % 2) cn.y++;
     
-  Color ** ppm = (Color **) matrix_new (cn.y, cn.x, sizeof(Color));
-  unsigned char * ppm0 = &ppm[0][0].r;
-  int len = 3*cn.x*cn.y;
-  memset (ppm0, 0, len*sizeof (unsigned char));
   double cmap[NCMAP][3];
   (* map) (cmap);
 
-#if _MPI
-  foreach_region (p, box, cn, reduction(max:ppm0[:len]))
-#else
-  foreach_region (p, box, cn, cpu)
-#endif
-  {
-    double v;
-    if (mask.i >= 0) { // masking
-      if (linear) {
-	double m = interpolate_linear (point, mask, p.x, p.y, p.z);
-	if (m < 0.)
-	  v = nodata;
-	else
-	  v = interpolate_linear (point, f, p.x, p.y, p.z);
+  /**
+  Each process only stores the pixels of its own cells, as vertical
+  runs. When the grid is coarser than the image, it is cheaper to
+  loop over the cells and colour the pixels they contain, rather than
+  to locate the cell containing each pixel. */
+  
+  PpmImage image = {NULL, cn.y, array_new(), array_new()};
+  if (pid() == 0) {
+    image.ppm = (Color **) matrix_new (cn.y, cn.x, sizeof(Color));
+    memset (&image.ppm[0][0], 0, cn.x*cn.y*sizeof (Color));
+  }
+  long ncells = grid->n;
+  mpi_all_reduce (ncells, MPI_LONG, MPI_SUM);
+  if (ncells < npe()*cn.x*cn.y/4) {
+    double dx = (box[1].x - box[0].x)/cn.x, dy = (box[1].y - box[0].y)/cn.y;
+    foreach (serial) {
+      if (dimension < 3 || (fabs (z - box[0].z) <= Delta &&
+			    ppm_in_cell (point, (coord){x, y, box[0].z}))) {
+
+	/**
+	The range of pixels is first estimated, then adjusted so that
+	each pixel is coloured by exactly one cell. */
+	
+	int i0 = ceil ((x - Delta/2. - box[0].x)/dx - 0.5) - 1;
+	int i1 = floor ((x + Delta/2. - box[0].x)/dx - 0.5) + 1;
+	int j0 = ceil ((y - Delta/2. - box[0].y)/dy - 0.5) - 1;
+	int j1 = floor ((y + Delta/2. - box[0].y)/dy - 0.5) + 1;
+	if (i0 < 0) i0 = 0;
+	if (i1 >= cn.x) i1 = cn.x - 1;
+	if (j0 < 0) j0 = 0;
+	if (j1 >= cn.y) j1 = cn.y - 1;
+	for (; i0 <= i1; i0++)
+	  if (ppm_in_cell (point, (coord){box[0].x + dx*(i0 + 0.5), y, box[0].z}))
+	    break;
+	for (; i1 >= i0; i1--)
+	  if (ppm_in_cell (point, (coord){box[0].x + dx*(i1 + 0.5), y, box[0].z}))
+	    break;
+	for (; j0 <= j1; j0++)
+	  if (ppm_in_cell (point, (coord){x, box[0].y + dy*(j0 + 0.5), box[0].z}))
+	    break;
+	for (; j1 >= j0; j1--)
+	  if (ppm_in_cell (point, (coord){x, box[0].y + dy*(j1 + 0.5), box[0].z}))
+	    break;
+	for (int i = i0; i <= i1; i++)
+	  for (int j = j0; j <= j1; j++) {
+	    coord p = {box[0].x + dx*(i + 0.5), box[0].y + dy*(j + 0.5), box[0].z};
+	    ppm_add_pixel (&image, i, j,
+			   ppm_color (point, f, mask, linear, p, cmap, min, max));
+	  }
       }
-      else {
-	if (mask[] < 0.)
-	  v = nodata;
-	else
-	  v = f[];
+    }
+  }
+  else
+    foreach_region (p, box, cn, cpu) {
+      int i = (p.x - box[0].x)/(box[1].x - box[0].x)*cn.x;
+      int j = (p.y - box[0].y)/(box[1].y - box[0].y)*cn.y;
+      ppm_add_pixel (&image, i, j,
+		     ppm_color (point, f, mask, linear, p, cmap, min, max));
+    }
+
+  /**
+  The runs are gathered on the root process. */
+  
+#if _MPI
+  Array * local[2] = {image.runs, image.colors};
+  int len[2] = {local[0]->len, local[1]->len}, lens[pid() == 0 ? 2*npe() : 2];
+  MPI_Gather (len, 2, MPI_INT, lens, 2, MPI_INT, 0, MPI_COMM_WORLD);
+  for (int k = 0; k < 2; k++) {
+    Array * a = array_new();
+    int count[npe()], displ[npe()];
+    if (pid() == 0) {
+      for (int i = 0; i < npe(); i++) {
+	count[i] = lens[2*i + k], displ[i] = a->len;
+	a->len += count[i];
       }
+      a->max = a->len + 1;
+      a->p = malloc (a->max);
     }
-    else if (linear)
-      v = interpolate_linear (point, f, p.x, p.y, p.z);
-    else
-      v = f[];
-    int i = (p.x - box[0].x)/(box[1].x - box[0].x)*cn.x;
-    int j = (p.y - box[0].y)/(box[1].y - box[0].y)*cn.y;
-    Color ** alias = ppm; // so that qcc considers ppm a local variable
-    alias[(int)cn.y - 1 - j][i] = colormap_color (cmap, v, min, max);	    
+    MPI_Gatherv (local[k]->p, len[k], MPI_BYTE,
+		 a->p, count, displ, MPI_BYTE, 0, MPI_COMM_WORLD);
+    array_free (local[k]);
+    local[k] = a;
   }
+  image.runs = local[0], image.colors = local[1];
+#endif // _MPI
   
   if (pid() == 0) {
+    Color ** ppm = image.ppm, * c = image.colors->p;
+    for (PpmRun * r = image.runs->p;
+	 (char *) r < (char *) image.runs->p + image.runs->len; r++)
+      for (int j = r->j; j < r->j + r->len; j++)
+	ppm[(int)cn.y - 1 - j][r->i] = *c++;
+    unsigned char * ppm0 = &ppm[0][0].r;
+    
     if (file)
       fp = open_image (file, opt);
     
@@ -682,9 +870,10 @@ void output_ppm (scalar f,
 	fprintf (checksum, "%s: ", file);
       fprintf (checksum, "checksum: %08lx\n", (unsigned long) a32_hash (&hash));
     }
+    matrix_free (ppm);
   }
-    
-  matrix_free (ppm);
+  array_free (image.runs);
+  array_free (image.colors);
 }
 
 /**
@@ -1012,7 +1201,12 @@ default is "dump".
 
 *zero*
 : whether to dump fields which are zero. Default is true.
-*/
+
+If [*output_async*](output-writer.h) is set and a *file* name is
+given, *dump()* returns as soon as the snapshot has been copied in
+memory, and the file is written in the background (this is not
+implemented yet with MPI). The file is then only guaranteed to be on
+disk after a call to [*output_flush()*](output-writer.h). */
 
 struct DumpHeader {
   double t;
@@ -1073,6 +1267,34 @@ static void dump_header (FILE * fp, struct DumpHeader * header, scalar * list)
 }
 
 #if !_MPI
+typedef struct {
+  OutputJob job;
+  char * name, * file, * buf;
+  size_t len;
+} DumpJob;
+
+static void dump_job_write (OutputJob * o, bool parallel)
+{
+  DumpJob * job = (DumpJob *) o;
+  FILE * fp = fopen (job->name, "w");
+  if (fp == NULL) {
+    perror (job->name);
+    exit (1);
+  }
+  if (fwrite (job->buf, 1, job->len, fp) < job->len) {
+    perror ("dump(): error while writing snapshot");
+    exit (1);
+  }
+  fclose (fp);
+  if (job->file) {
+    rename (job->name, job->file);
+    free (job->file);
+  }
+  sysfree (job->buf);
+  free (job->name);
+  free (job);
+}
+
 trace
 void dump (const char * file = "dump",
 	   scalar * list = all,
@@ -1081,12 +1303,20 @@ void dump (const char * file = "dump",
 	   bool zero = true)
 {
   char * name = NULL;
+  DumpJob * job = NULL;
   if (!fp) {
     name = (char *) malloc (strlen(file) + 2);
     strcpy (name, file);
     if (!unbuffered)
       strcat (name, "~");
-    if ((fp = fopen (name, "w")) == NULL) {
+    if (output_async) {
+      job = calloc (1, sizeof (DumpJob));
+      job->job.write = dump_job_write;
+      fp = open_memstream (&job->buf, &job->len);
+    }
+    else
+      fp = fopen (name, "w");
+    if (fp == NULL) {
       perror (name);
       exit (1);
     }
@@ -1119,7 +1349,7 @@ void dump (const char * file = "dump",
       exit (1);
     }
     for (scalar s in slist) {
-      double val = s[];
+      double val = s.leafonly && !is_leaf(cell) ? nodata : s[];
       if (fwrite (&val, sizeof(double), 1, fp) < 1) {
 	perror ("dump(): error while writing scalars");
 	exit (1);
@@ -1130,7 +1360,14 @@ void dump (const char * file = "dump",
   }
   
   free (slist);
-  if (file) {
+  if (job) {
+    fclose (fp);
+    job->name = name;
+    if (!unbuffered)
+      job->file = strdup (file);
+    output_submit (&job->job);
+  }
+  else if (file) {
     fclose (fp);
     if (!unbuffered)
       rename (name, file);
@@ -1198,7 +1435,7 @@ void dump (const char * file = "dump",
       unsigned flags = is_leaf(cell) ? leaf : 0;
       fwrite (&flags, 1, sizeof(unsigned), fh);
       for (scalar s in slist) {
-	double val = s[];
+	double val = s.leafonly && !is_leaf(cell) ? nodata : s[];
 	fwrite (&val, 1, sizeof(double), fh);
       }
       pos += cell_size;
@@ -1221,6 +1458,7 @@ bool restore (const char * file = "dump",
 	      scalar * list = NULL,
 	      FILE * fp = NULL)
 {
+  output_flush(); // the file may still be being written
   if (!fp && (fp = fopen (file, "r")) == NULL)
     return false;
   assert (fp);
@@ -1365,6 +1603,10 @@ bool restore (const char * file = "dump",
   for (scalar s in all)
     s.dirty = true;
 #endif
+
+  // the fields have been modified outside of foreach() loops
+  for (scalar s in all)
+    s.stamp++;
   
   scalar * other = NULL;
   for (scalar s in all)
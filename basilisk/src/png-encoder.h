@@ -0,0 +1,657 @@
+/**
+# A parallel PNG encoder
+
+This is a self-contained encoder for [Portable Network
+Graphics](https://en.wikipedia.org/wiki/PNG) images. It is used by
+[open_image()](output.h#imageanimation-conversion) so that PNG files
+can be written without calling external programs.
+
+The image is split into horizontal stripes which are filtered and
+compressed independently (and in parallel, using OpenMP) with
+[DEFLATE](https://en.wikipedia.org/wiki/Deflate), i.e. LZ77 matching
+followed by dynamic Huffman coding. Each stripe ends on a byte
+boundary (using an empty stored block, as done by
+[pigz](https://zlib.net/pigz/)) so that the compressed stripes can
+simply be concatenated into a single zlib stream. The number of
+stripes depends only on the size of the image, so that the file
+written does not depend on the number of threads. */
+
+#include <stdint.h>
+
+#define PNG_STRIPE (1 << 18) // minimum size (in bytes) of a stripe
+#define PNG_WINDOW (1 << 15) // size of the LZ77 window
+#define PNG_HASH   (1 << 15) // size of the LZ77 hash table
+#define PNG_CHAIN  32        // maximum length of the LZ77 hash chains
+#define PNG_BLOCK  (1 << 15) // maximum number of symbols per block
+
+/**
+## Checksums and tables
+
+The CRC-32 of PNG chunks, the Adler-32 checksum of zlib streams and
+the base values and extra bits of the DEFLATE length and distance
+codes. */
+
+static uint32_t png_crc_table[256];
+static uint8_t png_length_code[259], png_dist_code[512];
+
+static const uint16_t png_length_base[29] = {
+  3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+  35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258
+};
+static const uint8_t png_length_extra[29] = {
+  0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+  3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0
+};
+static const uint16_t png_dist_base[30] = {
+  1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+  257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145,
+  8193, 12289, 16385, 24577
+};
+static const uint8_t png_dist_extra[30] = {
+  0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+  7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13
+};
+
+static void png_init_tables()
+{
+  static bool initialized = false;
+  if (initialized)
+    return;
+  for (uint32_t i = 0; i < 256; i++) {
+    uint32_t c = i;
+    for (int k = 0; k < 8; k++)
+      c = c & 1 ? 0xedb88320 ^ (c >> 1) : c >> 1;
+    png_crc_table[i] = c;
+  }
+  for (int c = 0; c < 29; c++)
+    for (int l = png_length_base[c];
+	 l < png_length_base[c] + (1 << png_length_extra[c]) && l <= 258; l++)
+      png_length_code[l] = c;
+  png_length_code[258] = 28;
+
+  /**
+  Distances up to 256 are looked up directly, larger distances using
+  their upper bits (as done in zlib). */
+
+  for (int c = 0; c < 30; c++)
+    for (int d = png_dist_base[c]; d < png_dist_base[c] + (1 << png_dist_extra[c]);
+	 d++)
+      if (d <= 256)
+	png_dist_code[d - 1] = c;
+      else
+	png_dist_code[256 + ((d - 1) >> 7)] = c;
+  initialized = true;
+}
+
+static inline int png_distance_code (int d)
+{
+  return d <= 256 ? png_dist_code[d - 1] : png_dist_code[256 + ((d - 1) >> 7)];
+}
+
+static uint32_t png_crc (uint32_t crc, const unsigned char * buf, size_t len)
+{
+  crc = ~crc;
+  while (len--)
+    crc = png_crc_table[(crc ^ *buf++) & 0xff] ^ (crc >> 8);
+  return ~crc;
+}
+
+static uint32_t png_adler (uint32_t adler, const unsigned char * buf, size_t len)
+{
+  uint32_t a = adler & 0xffff, b = adler >> 16;
+  while (len) {
+    size_t n = len < 5552 ? len : 5552;
+    len -= n;
+    while (n--)
+      a += *buf++, b += a;
+    a %= 65521, b %= 65521;
+  }
+  return (b << 16) | a;
+}
+
+/**
+The checksum of the concatenation of two buffers, given the checksums
+of each buffer and the length of the second one (from zlib). */
+
+static uint32_t png_adler_combine (uint32_t adler1, uint32_t adler2, size_t len2)
+{
+  const uint32_t base = 65521;
+  uint32_t rem = len2 % base;
+  uint32_t sum1 = adler1 & 0xffff;
+  uint32_t sum2 = (rem*sum1) % base;
+  sum1 += (adler2 & 0xffff) + base - 1;
+  sum2 += (adler1 >> 16) + (adler2 >> 16) + base - rem;
+  if (sum1 >= base) sum1 -= base;
+  if (sum1 >= base) sum1 -= base;
+  if (sum2 >= 2*base) sum2 -= 2*base;
+  if (sum2 >= base) sum2 -= base;
+  return sum1 | (sum2 << 16);
+}
+
+/**
+## Bit streams */
+
+typedef struct {
+  unsigned char * buf;
+  size_t len, size;
+  uint64_t bits;
+  int nbits;
+} PngStream;
+
+static void png_put_byte (PngStream * s, unsigned char c)
+{
+  if (s->len == s->size) {
+    s->size = 2*s->size + 4096;
+    qrealloc (s->buf, s->size, unsigned char);
+  }
+  s->buf[s->len++] = c;
+}
+
+static void png_put_bits (PngStream * s, uint32_t value, int nbits)
+{
+  s->bits |= (uint64_t) value << s->nbits;
+  s->nbits += nbits;
+  while (s->nbits >= 8) {
+    png_put_byte (s, s->bits & 0xff);
+    s->bits >>= 8;
+    s->nbits -= 8;
+  }
+}
+
+static void png_put_uint32 (PngStream * s, uint32_t value)
+{
+  for (int i = 3; i >= 0; i--)
+    png_put_byte (s, (value >> 8*i) & 0xff);
+}
+
+/**
+## Huffman codes
+
+The code lengths are computed using the classical two-queue Huffman
+algorithm. Lengths larger than *maxbits* are then shortened by
+adjusting the number of codes of each length until the Kraft
+inequality is satisfied again (as done in miniz). */
+
+static void png_huffman (const uint32_t * freq, int n, int maxbits, uint8_t * lens)
+{
+  int sym[n], nsym = 0;
+  for (int i = 0; i < n; i++) {
+    lens[i] = 0;
+    if (freq[i]) {
+      int j = nsym++;
+      while (j > 0 && freq[sym[j - 1]] > freq[i])
+	sym[j] = sym[j - 1], j--;
+      sym[j] = i;
+    }
+  }
+  if (nsym == 0)
+    return;
+  if (nsym == 1) {
+    lens[sym[0]] = 1;
+    return;
+  }
+
+  uint32_t w[2*nsym];
+  int parent[2*nsym], nodes = nsym, ileaf = 0, inode = nsym;
+  for (int i = 0; i < nsym; i++)
+    w[i] = freq[sym[i]];
+  while (nodes < 2*nsym - 1) {
+    int a[2];
+    for (int k = 0; k < 2; k++)
+      a[k] = ileaf < nsym && (inode >= nodes || w[ileaf] <= w[inode]) ?
+	ileaf++ : inode++;
+    w[nodes] = w[a[0]] + w[a[1]];
+    parent[a[0]] = parent[a[1]] = nodes++;
+  }
+
+  int count[maxbits + 1], length[2*nsym];
+  for (int b = 0; b <= maxbits; b++)
+    count[b] = 0;
+  length[nodes - 1] = 0;
+  for (int i = nodes - 2; i >= 0; i--) {
+    length[i] = length[parent[i]] + 1;
+    if (i < nsym)
+      count[min (length[i], maxbits)]++;
+  }
+
+  uint32_t total = 0;
+  for (int b = 1; b <= maxbits; b++)
+    total += (uint32_t) count[b] << (maxbits - b);
+  while (total != 1 << maxbits) {
+    count[maxbits]--;
+    for (int b = maxbits - 1; b > 0; b--)
+      if (count[b]) {
+	count[b]--, count[b + 1] += 2;
+	break;
+      }
+    total--;
+  }
+
+  /**
+  The least frequent symbols get the longest codes. */
+
+  int i = 0;
+  for (int b = maxbits; b > 0; b--)
+    for (int c = count[b]; c > 0; c--)
+      lens[sym[i++]] = b;
+}
+
+/**
+Canonical codes, bit-reversed since DEFLATE writes Huffman codes
+starting from the most significant bit. */
+
+static void png_codes (const uint8_t * lens, int n, uint16_t * codes)
+{
+  int count[16] = {0}, next[16];
+  for (int i = 0; i < n; i++)
+    count[lens[i]]++;
+  count[0] = 0;
+  int code = 0;
+  for (int b = 1; b < 16; b++) {
+    code = (code + count[b - 1]) << 1;
+    next[b] = code;
+  }
+  for (int i = 0; i < n; i++)
+    if (lens[i]) {
+      int c = next[lens[i]]++, r = 0;
+      for (int b = 0; b < lens[i]; b++, c >>= 1)
+	r = (r << 1) | (c & 1);
+      codes[i] = r;
+    }
+}
+
+/**
+## DEFLATE blocks
+
+LZ77 matches are stored as (length, distance) pairs, literals have a
+zero distance. */
+
+typedef struct {
+  uint16_t length, dist;
+} PngSymbol;
+
+static void png_block (PngStream * s, const PngSymbol * sym, int nsym, bool final)
+{
+  uint32_t lfreq[286] = {0}, dfreq[30] = {0};
+  for (int i = 0; i < nsym; i++)
+    if (sym[i].dist) {
+      lfreq[257 + png_length_code[sym[i].length]]++;
+      dfreq[png_distance_code (sym[i].dist)]++;
+    }
+    else
+      lfreq[sym[i].length]++;
+  lfreq[256] = 1;
+
+  /**
+  Some decoders do not accept codes with a single symbol. */
+
+  if (nsym == 0)
+    lfreq[0] = 1;
+  int ndist = 0;
+  for (int i = 0; i < 30; i++)
+    ndist += dfreq[i] > 0;
+  if (ndist < 2)
+    dfreq[0] += 1, dfreq[1] += 1;
+
+  uint8_t lens[286 + 30];
+  uint16_t lcodes[286], dcodes[30];
+  png_huffman (lfreq, 286, 15, lens);
+  png_huffman (dfreq, 30, 15, lens + 286);
+  png_codes (lens, 286, lcodes);
+  png_codes (lens + 286, 30, dcodes);
+  int hlit = 286, hdist = 30;
+  while (!lens[hlit - 1]) hlit--;
+  while (!lens[286 + hdist - 1]) hdist--;
+
+  /**
+  The code lengths are themselves run-length encoded (with symbols 16
+  to 18) and Huffman coded. */
+
+  uint8_t all[286 + 30], cl[286 + 30], extra[286 + 30];
+  memcpy (all, lens, hlit);
+  memcpy (all + hlit, lens + 286, hdist);
+  int ncl = 0, nall = hlit + hdist;
+  for (int i = 0; i < nall;) {
+    int l = all[i], run = 1;
+    while (i + run < nall && all[i + run] == l)
+      run++;
+    i += run;
+    if (l == 0) {
+      while (run >= 11) {
+	int r = min (run, 138);
+	cl[ncl] = 18, extra[ncl++] = r - 11;
+	run -= r;
+      }
+      if (run >= 3)
+	cl[ncl] = 17, extra[ncl++] = run - 3, run = 0;
+    }
+    else if (run >= 4) {
+      cl[ncl++] = l, run--;
+      while (run >= 3) {
+	int r = min (run, 6);
+	cl[ncl] = 16, extra[ncl++] = r - 3;
+	run -= r;
+      }
+    }
+    while (run-- > 0)
+      cl[ncl++] = l;
+  }
+  uint32_t clfreq[19] = {0};
+  for (int i = 0; i < ncl; i++)
+    clfreq[cl[i]]++;
+  uint8_t cllens[19];
+  uint16_t clcodes[19];
+  png_huffman (clfreq, 19, 7, cllens);
+  png_codes (cllens, 19, clcodes);
+  static const uint8_t order[19] = {
+    16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15
+  };
+  int hclen = 19;
+  while (hclen > 4 && !cllens[order[hclen - 1]])
+    hclen--;
+
+  png_put_bits (s, final, 1);
+  png_put_bits (s, 2, 2);
+  png_put_bits (s, hlit - 257, 5);
+  png_put_bits (s, hdist - 1, 5);
+  png_put_bits (s, hclen - 4, 4);
+  for (int i = 0; i < hclen; i++)
+    png_put_bits (s, cllens[order[i]], 3);
+  for (int i = 0; i < ncl; i++) {
+    png_put_bits (s, clcodes[cl[i]], cllens[cl[i]]);
+    if (cl[i] >= 16)
+      png_put_bits (s, extra[i], cl[i] == 16 ? 2 : cl[i] == 17 ? 3 : 7);
+  }
+
+  for (int i = 0; i < nsym; i++)
+    if (sym[i].dist) {
+      int c = png_length_code[sym[i].length];
+      png_put_bits (s, lcodes[257 + c], lens[257 + c]);
+      png_put_bits (s, sym[i].length - png_length_base[c], png_length_extra[c]);
+      c = png_distance_code (sym[i].dist);
+      png_put_bits (s, dcodes[c], lens[286 + c]);
+      png_put_bits (s, sym[i].dist - png_dist_base[c], png_dist_extra[c]);
+    }
+    else
+      png_put_bits (s, lcodes[sym[i].length], lens[sym[i].length]);
+  png_put_bits (s, lcodes[256], lens[256]);
+}
+
+/**
+## LZ77 compression
+
+This compresses *len* bytes of *src* using greedy matching with hash
+chains. Unless this is the *final* part of the stream, the output is
+terminated with an empty stored block so that it ends on a byte
+boundary. */
+
+static inline uint32_t png_hash (const unsigned char * p)
+{
+  return ((p[0] << 10) ^ (p[1] << 5) ^ p[2]) & (PNG_HASH - 1);
+}
+
+static void png_deflate (PngStream * s, const unsigned char * src, size_t len,
+			 bool final)
+{
+  long * head = malloc (PNG_HASH*sizeof (long));
+  long * prev = malloc (PNG_WINDOW*sizeof (long));
+  PngSymbol * sym = malloc (PNG_BLOCK*sizeof (PngSymbol));
+  for (int i = 0; i < PNG_HASH; i++)
+    head[i] = -1;
+
+  int nsym = 0;
+  long i = 0;
+  while (i < len) {
+    long best = 0, dist = 0;
+    if (i + 3 <= len) {
+      long maxlen = min (258, len - i), j = head[png_hash (src + i)];
+      for (int chain = PNG_CHAIN; j >= 0 && i - j <= PNG_WINDOW && chain > 0;
+	   chain--, j = prev[j & (PNG_WINDOW - 1)])
+	if (src[j + best] == src[i + best]) {
+	  long l = 0;
+	  while (l < maxlen && src[j + l] == src[i + l])
+	    l++;
+	  if (l > best) {
+	    best = l, dist = i - j;
+	    if (l == maxlen)
+	      break;
+	  }
+	}
+    }
+
+    /**
+    Short matches with far-away data are not worth it. */
+
+    if (best < 3 || (best == 3 && dist > 4096))
+      best = 1, dist = 0;
+    sym[nsym].length = dist ? best : src[i];
+    sym[nsym++].dist = dist;
+    for (long k = i; k < i + best; k++)
+      if (k + 3 <= len) {
+	uint32_t h = png_hash (src + k);
+	prev[k & (PNG_WINDOW - 1)] = head[h];
+	head[h] = k;
+      }
+    i += best;
+
+    if (nsym == PNG_BLOCK) {
+      png_block (s, sym, nsym, final && i == len);
+      nsym = 0;
+    }
+  }
+  if (nsym > 0 || len == 0)
+    png_block (s, sym, nsym, final);
+  if (!final) {
+    png_put_bits (s, 0, 3);
+    if (s->nbits > 0)
+      png_put_bits (s, 0, 8 - s->nbits);
+    png_put_uint32 (s, 0x0000ffff);
+  }
+  else if (s->nbits > 0)
+    png_put_bits (s, 0, 8 - s->nbits);
+
+  free (head);
+  free (prev);
+  free (sym);
+}
+
+/**
+## Filtering
+
+Each row is filtered with the PNG filter (none, sub, up, average or
+Paeth) which minimises the sum of the absolute values of the filtered
+bytes. */
+
+static inline int png_paeth (int a, int b, int c)
+{
+  int p = a + b - c, pa = abs (p - a), pb = abs (p - b), pc = abs (p - c);
+  return pa <= pb && pa <= pc ? a : pb <= pc ? b : c;
+}
+
+static void png_filter (const unsigned char * row, const unsigned char * above,
+			int n, unsigned char * out, unsigned char * tmp)
+{
+  long best = -1;
+  for (int f = 0; f < 5; f++) {
+    long sum = 0;
+    for (int i = 0; i < n; i++) {
+      int a = i >= 3 ? row[i - 3] : 0, b = above ? above[i] : 0;
+      int c = i >= 3 && above ? above[i - 3] : 0;
+      int p = f == 0 ? 0 : f == 1 ? a : f == 2 ? b : f == 3 ? (a + b)/2 :
+	png_paeth (a, b, c);
+      tmp[i] = row[i] - p;
+      sum += tmp[i] < 128 ? tmp[i] : 256 - tmp[i];
+    }
+    if (best < 0 || sum < best) {
+      best = sum;
+      out[0] = f;
+      memcpy (out + 1, tmp, n);
+    }
+  }
+}
+
+/**
+## Encoding and writing
+
+The function below returns the PNG encoding of the *width* x *height*
+RGB image *rgb* (stored row by row, starting from the top). Its size
+is returned in *size*. The stripes are compressed in parallel if
+*parallel* is true. */
+
+unsigned char * png_encode (const unsigned char * rgb, int width, int height,
+			    size_t * size, bool parallel)
+{
+  png_init_tables();
+  int n = 3*width;
+  size_t line = n + 1;
+  int rows = max (1, PNG_STRIPE/line), nstripes = (height + rows - 1)/rows;
+  unsigned char * filtered = malloc (line*height);
+  PngStream stripes[nstripes];
+  uint32_t adler[nstripes];
+  OMP (omp parallel for schedule(dynamic) if(parallel))
+  for (int k = 0; k < nstripes; k++) {
+    int start = k*rows, end = min (start + rows, height);
+    unsigned char * tmp = malloc (n);
+    for (int j = start; j < end; j++)
+      png_filter (rgb + (size_t) j*n, j > 0 ? rgb + (size_t) (j - 1)*n : NULL,
+		  n, filtered + j*line, tmp);
+    free (tmp);
+    stripes[k] = (PngStream){0};
+    png_deflate (&stripes[k], filtered + start*line, (end - start)*line,
+		 k == nstripes - 1);
+    adler[k] = png_adler (1, filtered + start*line, (end - start)*line);
+  }
+  free (filtered);
+
+  PngStream s = {0};
+  const unsigned char signature[8] = {137, 80, 78, 71, 13, 10, 26, 10};
+  for (int i = 0; i < 8; i++)
+    png_put_byte (&s, signature[i]);
+
+  png_put_uint32 (&s, 13);
+  size_t chunk = s.len;
+  png_put_uint32 (&s, 0x49484452); // "IHDR"
+  png_put_uint32 (&s, width);
+  png_put_uint32 (&s, height);
+  png_put_byte (&s, 8); // bit depth
+  png_put_byte (&s, 2); // RGB
+  png_put_byte (&s, 0), png_put_byte (&s, 0), png_put_byte (&s, 0);
+  png_put_uint32 (&s, png_crc (0, s.buf + chunk, s.len - chunk));
+
+  size_t total = 6;
+  for (int k = 0; k < nstripes; k++)
+    total += stripes[k].len;
+  png_put_uint32 (&s, total);
+  chunk = s.len;
+  png_put_uint32 (&s, 0x49444154); // "IDAT"
+  png_put_byte (&s, 0x78), png_put_byte (&s, 0x01); // zlib header
+  uint32_t sum = 1;
+  for (int k = 0; k < nstripes; k++) {
+    for (size_t i = 0; i < stripes[k].len; i++)
+      png_put_byte (&s, stripes[k].buf[i]);
+    free (stripes[k].buf);
+    int end = min ((k + 1)*rows, height);
+    sum = png_adler_combine (sum, adler[k], (end - k*rows)*line);
+  }
+  png_put_uint32 (&s, sum);
+  png_put_uint32 (&s, png_crc (0, s.buf + chunk, s.len - chunk));
+
+  png_put_uint32 (&s, 0);
+  chunk = s.len;
+  png_put_uint32 (&s, 0x49454e44); // "IEND"
+  png_put_uint32 (&s, png_crc (0, s.buf + chunk, s.len - chunk));
+
+  *size = s.len;
+  return s.buf;
+}
+
+/**
+The function below writes to *fp* the PNG encoding of the binary
+([P6](https://en.wikipedia.org/wiki/Netpbm#PPM_example)) PPM image
+*ppm* of size *len*, as generated by [output_ppm()](output.h) or
+[save()](view.h) for example. It returns false if the PPM image is
+not valid. */
+
+static const unsigned char * png_ppm_pixels (const char * ppm, size_t len,
+					     int * width, int * height)
+{
+  int maxval, offset = 0;
+  char header[64];
+  size_t n = min (len, sizeof (header) - 1);
+  memcpy (header, ppm, n);
+  header[n] = '\0';
+  if (n < 2 || strncmp (header, "P6", 2) ||
+      sscanf (header + 2, "%d %d %d%n", width, height, &maxval, &offset) != 3 ||
+      maxval != 255 || *width <= 0 || *height <= 0 ||
+      2 + offset + 1 + 3*(size_t) *width * *height > len)
+    return NULL;
+  return (const unsigned char *) ppm + 2 + offset + 1;
+}
+
+bool png_write_ppm (FILE * fp, const char * ppm, size_t len, bool parallel = true)
+{
+  int width, height;
+  const unsigned char * rgb = png_ppm_pixels (ppm, len, &width, &height);
+  if (!rgb)
+    return false;
+  size_t size;
+  unsigned char * png = png_encode (rgb, width, height, &size, parallel);
+  bool ok = fwrite (png, 1, size, fp) == size;
+  free (png);
+  return ok;
+}
+
+/**
+## Background writer
+
+If *png_async* (an alias of
+[*output_async*](output-writer.h)) is set to true, images are
+encoded and written to disk by the background writer, so that the
+simulation does not wait for them. The images are then encoded using
+a single thread. The *png_flush()* function (an alias of
+*output_flush()*) waits until all the images have been written. */
+
+#include "output-writer.h"
+
+#define png_async output_async
+#define png_flush output_flush
+
+typedef struct {
+  OutputJob job;
+  char * file, * ppm;
+  size_t len;
+} PngJob;
+
+static void png_job_write (OutputJob * o, bool parallel)
+{
+  PngJob * job = (PngJob *) o;
+  FILE * fp = fopen (job->file, "w");
+  if (!fp)
+    perror (job->file);
+  else {
+    if (!png_write_ppm (fp, job->ppm, job->len, parallel))
+      fprintf (ferr, "src/png-encoder.h:%d: warning: invalid PPM image '%s'\n",
+	       LINENO, job->file);
+    fclose (fp);
+  }
+  sysfree (job->ppm);
+  free (job->file);
+  free (job);
+}
+
+/**
+This function writes the PPM image *ppm* of size *len* as a PNG
+image in *file*. The *ppm* buffer must have been allocated with the
+system malloc() (e.g. by open_memstream()) and is freed once the image
+has been written. */
+
+void png_save_ppm (const char * file, char * ppm, size_t len)
+{
+  PngJob * job = calloc (1, sizeof (PngJob));
+  job->job.write = png_job_write;
+  job->file = strdup (file);
+  job->ppm = ppm;
+  job->len = len;
+  png_init_tables();
+  output_submit (&job->job);
+}
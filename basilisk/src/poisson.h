@@ -27,7 +27,22 @@ approximate solution $\tilde{a}$.
 Here we implement the multigrid cycle proper. Given an initial guess
 *a*, a residual *res*, a correction field *da* and a relaxation
 function *relax*, we will provide an improved guess at the end of the
-cycle. */
+cycle.
+
+The total number of relaxed cells (on all levels) is accumulated in
+`mg_relaxations`, which can be used to estimate the cost of the
+multigrid solvers (see e.g. [perfs.h](navier-stokes/perfs.h)). */
+
+long mg_relaxations = 0;
+
+static long mg_level_cells (int l)
+{
+#if TREE
+  return tree->active[l].n;
+#else
+  return grid->n >> dimension*(depth() - l);
+#endif
+}
 
 trace
 void mg_cycle (scalar * a, scalar * res, scalar * da,
@@ -78,6 +93,7 @@ void mg_cycle (scalar * a, scalar * res, scalar * da,
       boundary_level (da, l);
       relax (da, res, l, data);
     }
+    mg_relaxations += nrelax*mg_level_cells (l);
   }
 
   /**
@@ -67,6 +67,7 @@ void run()
     delete (updates);
     free (updates);
     update_perf();
+    scratch_recycle();
     iter = inext, t = tnext;
   }
   timer_print (perf.gt, iter, perf.tnc);
@@ -25,6 +25,13 @@ void run (void)
     speed statistics. */
 
     update_perf();
+
+    /**
+    The trailing temporary field slots are released if fewer slots
+    were used during this timestep (see
+    [scratch_recycle()](grid/cartesian-common.h)). */
+
+    scratch_recycle();
     iter = inext, t = tnext;
   }
 
@@ -45,13 +45,80 @@ static long lookup_tag (Array * a, double tag)
   return s;
 }
 
+/**
+The neighborhoods are built using a [disjoint-set
+forest](https://en.wikipedia.org/wiki/Disjoint-set_data_structure)
+(or "union-find" structure). The root of each set is always its
+element of smallest index, so that the sets are numbered in the
+order of the traversal. */
+
+static long find_tag (long * forest, long i)
+{
+  while (forest[i] != i)
+    i = forest[i] = forest[forest[i]];
+  return i;
+}
+
+static void union_tag (long * forest, long i, long j)
+{
+  i = find_tag (forest, i), j = find_tag (forest, j);
+  if (i < j)
+    forest[j] = i;
+  else if (j < i)
+    forest[i] = j;
+}
+
 #if _MPI
 static int compar_double (const void * p1, const void * p2)
 {
   const double * a = p1, * b = p2;
-  return *a > *b;
+  return *a > *b ? 1 : *a < *b ? -1 : 0;
+}
+
+static int compar_pair (const void * p1, const void * p2)
+{
+  const double * a = p1, * b = p2;
+  return a[0] != b[0] ? compar_double (a, b) : compar_double (a + 1, b + 1);
+}
+
+/**
+This sorts an array of doubles (or of pairs of doubles if *size* is
+two) and removes duplicated entries. */
+
+static void unique_tags (Array * a, int size)
+{
+  long len = a->len/(size*sizeof(double));
+  if (len == 0)
+    return;
+  double * p = (double *) a->p;
+  qsort (p, len, size*sizeof(double), size == 1 ? compar_double : compar_pair);
+  long n = 1;
+  for (long i = 1; i < len; i++)
+    if (memcmp (p + i*size, p + (n - 1)*size, size*sizeof(double)))
+      memcpy (p + (n++)*size, p + i*size, size*sizeof(double));
+  a->len = n*size*sizeof(double);
 }
-#endif
+
+/**
+In parallel, this gathers the arrays of all processes (of *size*
+doubles each) into a single (sorted) array. */
+
+static Array * allgather_tags (Array * a, int size)
+{
+  int len = a->len/sizeof(double), counts[npe()], displs[npe()];
+  MPI_Allgather (&len, 1, MPI_INT, counts, 1, MPI_INT, MPI_COMM_WORLD);
+  long total = 0;
+  for (int i = 0; i < npe(); i++)
+    displs[i] = total, total += counts[i];
+  Array * g = array_new();
+  g->p = malloc (max(total, 1)*sizeof(double));
+  g->len = g->max = total*sizeof(double);
+  MPI_Allgatherv (a->p, len, MPI_DOUBLE, g->p, counts, displs, MPI_DOUBLE,
+		  MPI_COMM_WORLD);
+  unique_tags (g, size);
+  return g;
+}
+#endif // _MPI
 
 /**
 The function just takes the scalar field *t* which holds the initial
@@ -63,7 +130,9 @@ int tag (scalar t)
 {
 
   /**
-  We first set the restriction and prolongation functions (on trees). */
+  We first set the restriction and prolongation functions (on
+  trees). The values of the tags in the prolongation halos are thus
+  those of the (coarser) parent leaf cells. */
 
   t.restriction = restriction_tag;
 #if TREE  
@@ -73,195 +142,177 @@ int tag (scalar t)
 
   /**
   As an initial guess, we set all the (leaf) cells which have a
-  non-zero initial tag value to the Z- (or Morton-) index. We thus
+  non-zero initial tag value to their index in the traversal. We thus
   have a different "neighborhood" for each cell which has a non-zero
   initial tag, and a single neighborhood (tagged zero) for all the
-  cells which have a zero initial tag. */
-  
+  cells which have a zero initial tag. In parallel, the indices of
+  each process are shifted by the number of tagged cells on the
+  processes of lower rank, so that they are globally unique and
+  ordered as the (global) Z-ordering. */
+
+  long nl = 0;
+  foreach (serial)
+    if (t[] != 0)
+      nl++;
+  long offset = 0;
 #if _MPI
-  scalar index[];
-  z_indexing (index, true);
-  foreach()
-    t[] = (t[] != 0)*(index[] + 1);
-#else // !_MPI
-  long i = 1;
+  MPI_Exscan (&nl, &offset, 1, MPI_LONG, MPI_SUM, MPI_COMM_WORLD);
+  if (pid() == 0)
+    offset = 0;
+#endif
+  long * forest = malloc (max(nl, 1)*sizeof(long)), i = 0;
   foreach (serial)
-    t[] = (t[] != 0)*i++;
-#endif // !_MPI
+    if (t[] != 0) {
+      forest[i] = i;
+      t[] = offset + ++i;
+    }
 
   /**
-  To gather cells which belong to the same neighborhood, we repeat
-  multigrid iterations until none of the tag values changes. */
-  
-  bool changed;
-  do {
-
-    /**
-    We first do a restriction from the finest to the coarsest level of
-    the multigrid hierarchy, using the `restriction_tag()` function
-    above. */
-    
-    restriction ({t});
-
-    /**
-    We then go from the coarsest to the finest level and update the
-    tag values. */
-
-    changed = false;
-    for (int l = 1; l <= grid->maxdepth; l++) {
-
-      /**
-      If the parent tag is non-zero, we set the child tag to the value
-      of its parent (i.e. to the minimum tag value of its
-      siblings). */
-      
-      foreach_level(l)
-	if (coarse(t))
-	  t[] = coarse(t);
-      boundary_level ({t}, l);
-
-      /**
-      For cells which verify the threshold condition (i.e. for which
-      `t[] != 0`), we refine this initial guess by taking the minimum
-      (non-zero) tag value of its closest neighbors. We also track
-      whether this update changes any of the tag values. */
-      
-      foreach_level (l, reduction(||:changed))
-        if (t[]) {
-	  double min = t[];
-	  foreach_neighbor(1)
-	    if (t[] && t[] < min)
-	      min = t[];
-
-	  /**
-	  On trees, we need to take into account the minimum tag value
-	  of neighboring fine cells. */
-	  
+  To gather cells which belong to the same neighborhood, we merge the
+  sets of each tagged cell and of its tagged neighbors (including
+  diagonal neighbors). On trees, the neighbors of a leaf cell are
+  either leaf cells of the same level, prolongation halos (which hold
+  the tag of their coarser parent) or refined cells. The latter are
+  taken into account by their (finer) children since the leaf cell is
+  one of their prolongation halos. Neighbors which belong to other
+  processes are left for the parallel merge below. */
+
+  foreach (serial)
+    if (t[] > 0) {
+      long k = t[] - offset - 1;
+      foreach_neighbor(1)
+	if (t[] > 0
 #if TREE
-	  foreach_dimension()
-	    for (int i = -1; i <= 2; i += 3)
-	      if (is_refined (neighbor((2*i - 1)/3)))
-		for (int j = 0; j <= 1; j++)
-		  for (int k = 0; k <= 1; k++)
-		    if (fine(t,i,j,k) && fine(t,i,j,k) < min)
-		      min = fine(t,i,j,k);
-#endif // TREE
-
-	  if (t[] != min) {
-	    changed = true;
-	    t[] = min;
-	  }
+	    && !is_refined(cell)
+#endif
+	    ) {
+	  long l = t[] - offset - 1;
+	  if (l >= 0 && l < nl)
+	    union_tag (forest, k, l);
 	}
-      boundary_level ({t}, l);
     }
-  } while (changed);
 
   /**
-  ## Reducing the range of indices
+  The root of each set is now the set element with the smallest
+  index. Since the parent of each element has a smaller index, a
+  single pass is enough to make each element point directly to its
+  root. */
 
-  Each neighborhood is now tagged with a unique index. The range of
-  indices is large however (between one and the total number of
-  leaves). The goal of this step is to reduce this range to between
-  one and the number of neighborhoods. To do this, we create an ordered
-  array of unique indices. */
-
-  Array * a = array_new();
-  foreach (serial)
-    if (t[] > 0) {
-  
-      /**
-      We first check whether the index is larger than the maximum or
-      smaller than the minimum value in the array. *s* is the
-      position of the (possibly new) index in the array. A negative
-      value means that the index is already in the array.  */
-  
-      double tag = t[], * ap = (double *) a->p;
-      long s = -1;
-      if (a->len == 0 || tag > ap[a->len/sizeof(double) - 1])
-	s = a->len/sizeof(double);
-      else if (tag < ap[0])
-	s = 0;
-      else {
-	
-	/**
-	We find the range of existing indices [s-1:s] which contains
-	the index. We check whether the index is already in the
-	array. */
-	
-	s = lookup_tag (a, tag) + 1;
-	if (tag == ap[s - 1] || tag == ap[s])
-	  s = -1;
-      }
-      if (s >= 0) {
-
-	/**
-	If the index is new, we add it to the array in the correct
-	position (s). */
-	
-	array_append (a, &tag, sizeof(double)), ap = (double *) a->p;
-	for (int i = a->len/sizeof(double) - 1; i > s; i--)
-	  ap[i] = ap[i-1];
-	ap[s] = tag;
-      }
-    }
+  for (long k = 0; k < nl; k++)
+    forest[k] = forest[forest[k]];
 
   /**
-  ## Parallel reduction
+  *label* will hold the (global) index of each neighborhood, stored
+  for its root element. */
 
-  Each process now has its own local correspondence map between the
-  neighborhood index and its rank in the array *a* (i.e. its reduced
-  index). In parallel, we now need to build a global correspondence map. 
+  double * label = malloc (max(nl, 1)*sizeof(double));
+  for (long k = 0; k < nl; k++)
+    label[k] = offset + k + 1;
 
-  We first get the maximum size over all processes of the local map
-  and increase the size of the local map to this value. */
+  /**
+  ## Parallel merge
+
+  Neighborhoods can span several processes. We first set the tag value
+  of each cell to the index of its (local) neighborhood. The halos
+  then contain the local neighborhood indices of the neighboring
+  processes. We collect the (unique) pairs of local and remote
+  neighborhoods which touch each other. */
 
 #if _MPI
-  long lmax = a->len;
-  mpi_all_reduce (lmax, MPI_LONG, MPI_MAX);
-  a->p = realloc (a->p, lmax);
-  lmax /= sizeof(double);
+  foreach()
+    if (t[] > 0)
+      t[] = offset + forest[(long) t[] - offset - 1] + 1;
+
+  Array * pairs = array_new();
+  foreach (serial)
+    if (t[] > 0) {
+      double p[2] = {t[], 0.};
+      foreach_neighbor(1)
+	if (t[] > 0 && (t[] <= offset || t[] > offset + nl)
+#if TREE
+	    && !is_refined(cell)
+#endif
+	    ) {
+	  p[1] = t[];
+	  array_append (pairs, p, 2*sizeof(double));
+	}
+    }
+  unique_tags (pairs, 2);
 
   /**
-  We then gather all the local maps into a global map and sort it. All
-  local arrays need to be of the same size to be able to use
-  MPI_Allgather(), so we first pad the arrays with -1. */
+  All the pairs are gathered on all processes which then merge the
+  corresponding sets, using another (global) disjoint-set forest over
+  the (sorted) indices involved. */
   
-  double * q = a->p;
-  for (int i = a->len/sizeof(double); i < lmax; i++)
-    q[i] = -1;
-  double p[lmax*npe()];
-  MPI_Allgather (a->p, lmax, MPI_DOUBLE, p, lmax, MPI_DOUBLE, MPI_COMM_WORLD);
-  qsort (p, lmax*npe(), sizeof(double), compar_double);
+  Array * all = allgather_tags (pairs, 2);
+  array_free (pairs);
+  Array * nodes = array_new();
+  array_append (nodes, all->p, all->len);
+  unique_tags (nodes, 1);
+  long nn = nodes->len/sizeof(double);
+  long * gforest = malloc (max(nn, 1)*sizeof(long));
+  for (long k = 0; k < nn; k++)
+    gforest[k] = k;
+  double * p = all->p;
+  for (long k = 0; k < all->len/sizeof(double); k += 2)
+    union_tag (gforest, lookup_tag (nodes, p[k]), lookup_tag (nodes, p[k + 1]));
+  array_free (all);
 
   /**
-  This sorted global map will (probably) contain duplicated entries
-  (i.e. indices of neighborhoods which span multiple processes). To
-  build the new global map (stored in *a*), we eliminate these, as well
-  as the negative indices which were used to pad the local arrays. */
+  The index of each local neighborhood which touches a remote
+  neighborhood becomes the smallest index of the global
+  neighborhood. */
   
-  array_free (a);
-  a = array_new();
-  double last = -1;
-  for (int i = 0; i < lmax*npe(); i++)
-    if (p[i] != last) {
-      array_append (a, &p[i], sizeof(double));
-      last = p[i];
+  double * node = nodes->p;
+  for (long k = 0; k < nl; k++)
+    if (forest[k] == k && nn > 0) {
+      long s = lookup_tag (nodes, label[k]);
+      if (node[s] == label[k])
+	label[k] = node[find_tag (gforest, s)];
     }
+  free (gforest);
+  array_free (nodes);
 #endif // _MPI
 
+  /**
+  ## Reducing the range of indices
+
+  Each neighborhood is now tagged with a unique index. The range of
+  indices is large however (between one and the total number of
+  leaves). The goal of this step is to reduce this range to between
+  one and the number of neighborhoods. To do this, we create an ordered
+  array of unique indices. */
+
+  Array * a = array_new();
+  for (long k = 0; k < nl; k++)
+    if (forest[k] == k)
+      array_append (a, &label[k], sizeof(double));
+
+#if _MPI
+  unique_tags (a, 1);
+  Array * ga = allgather_tags (a, 1);
+  array_free (a);
+  a = ga;
+#endif
+
   /**
   Once we have the (global) map, we can replace the neighborhood
   indices with their index in the global map (+1). */
-  
+
+  for (long k = 0; k < nl; k++)
+    if (forest[k] == k)
+      label[k] = lookup_tag (a, label[k]) + 1;
   foreach()
     if (t[] > 0)
-      t[] = lookup_tag (a, t[]) + 1;
+      t[] = label[forest[(long) t[] - offset - 1]];
 
   /**
   We return the maximum index value. */
   
   int n = a->len/sizeof(double);
   array_free (a);
+  free (label);
+  free (forest);
   return n;
 }
 
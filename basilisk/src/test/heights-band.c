@@ -0,0 +1,47 @@
+/**
+# Heights within an interfacial band
+
+We check that the height functions and the curvature computed using
+the interfacial band (`heights_band = true`) are identical to those
+obtained by the default (full) traversal, on an adaptive mesh. */
+
+#include "fractions.h"
+#include "curvature.h"
+
+int main()
+{
+  origin (-0.5, -0.5);
+  init_grid (16);
+  scalar f[];
+  for (int l = 6; l <= 8; l++) {
+    do
+      fraction (f, sq(0.3) - sq(x - 0.03)/2. - sq(y + 0.02));
+    while (adapt_wavelet ({f}, (double[]){1e-3}, l, 4).nf);
+    fraction (f, sq(0.3) - sq(x - 0.03)/2. - sq(y + 0.02));
+
+    vector h0[], h1[];
+    scalar k0[], k1[];
+    heights_band = false;
+    heights (f, h0);
+    curvature (f, k0);
+    heights_band = true;
+    heights (f, h1);
+    curvature (f, k1);
+    heights_band = false;
+
+    long nh = 0, nk = 0, nd = 0;
+    foreach (reduction(+:nh) reduction(+:nk) reduction(+:nd)) {
+      foreach_dimension()
+	if (h0.x[] != nodata)
+	  nh++;
+      if (k0[] != nodata)
+	nk++;
+      foreach_dimension()
+	if (h0.x[] != h1.x[])
+	  nd++;
+      if (k0[] != k1[])
+	nd++;
+    }
+    fprintf (stderr, "%d %ld %ld %ld %ld\n", l, grid->tn, nh, nk, nd);
+  }
+}
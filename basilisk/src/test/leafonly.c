@@ -0,0 +1,73 @@
+/**
+# Leaf-only fields
+
+We check that the values of a [leaf-only field](/src/grid/tree.h#leaf-only-fields)
+are preserved by mesh adaptation and by dump()/restore() and that
+accessing it on a non-leaf cell is an error. */
+
+#include "fractions.h"
+#include "utils.h"
+
+scalar f[], d[];
+
+static void check (const char * name)
+{
+  long n = 0, nd = 0;
+  double sf = 0., sd = 0.;
+  foreach (reduction(+:n) reduction(+:nd) reduction(+:sf) reduction(+:sd)) {
+    n++, sf += f[]*dv(), sd += d[]*dv();
+    if (fabs (d[] - 1. - f[]) > 1e-12)
+      nd++;
+  }
+  fprintf (stderr, "%s: leaves: %ld nd: %ld %.12f %.12f\n", name, n, nd, sf, sd);
+}
+
+int main (int argc, char * argv[])
+{
+  origin (-0.5, -0.5);
+  init_grid (16);
+  d.leafonly = true;
+  tree_compact();
+
+  /**
+  Writing to the leaf-only field on non-leaf cells is an error. */
+
+  if (argc > 1) {
+    foreach_level (2)
+      d[] = 0.;
+    return 0;
+  }
+
+  /**
+  The leaf-only field is injected on refined cells and averaged on
+  coarsened cells. Since *f* is adapted using the same restriction
+  and the same (injection) refinement, both fields must remain
+  consistent. */
+
+  f.refine = refine_injection;
+  for (double xc = -0.2; xc <= 0.2; xc += 0.1) {
+    fraction (f, sq(0.25) - sq(x - xc) - sq(y));
+    foreach()
+      d[] = 1. + f[];
+    adapt_wavelet ({f}, (double[]){1e-2}, 7, 3);
+    check ("adapt");
+  }
+  fprintf (stderr, "fragmentation: %g\n", tree_fragmentation());
+
+  /**
+  Dump and restore. */
+
+  dump ("dump");
+  foreach()
+    f[] = d[] = 0.;
+  restore ("dump");
+  check ("restore");
+
+  /**
+  We check that the forbidden access above fails. */
+
+  char command[160];
+  snprintf (command, 160, "%s forbidden", argv[0]);
+  fflush (stderr);
+  fprintf (stderr, "failed: %d\n", system (command) != 0);
+}
@@ -0,0 +1,56 @@
+/**
+# Recycling of temporary field slots
+
+Temporary fields are allocated at the first timestep, then
+periodically. We check that the width of the cell records shrinks
+after the first timestep, grows again when needed and is then no
+longer shrunk, and that the values of a persistent field are
+preserved by these copies, on an adaptive mesh. */
+
+#include "run.h"
+
+scalar f[];
+
+int nvar() {
+  return datasize/sizeof(real);
+}
+
+void temporaries (int n)
+{
+  scalar * list = NULL;
+  for (int k = 0; k < n; k++) {
+    scalar s = new scalar;
+    list = list_append (list, s);
+  }
+  foreach() {
+    double v = f[];
+    for (scalar s in list)
+      s[] = v;
+  }
+  delete (list), free (list);
+}
+
+int main()
+{
+  origin (-0.5, -0.5);
+  N = 16;
+  run();
+}
+
+event init (i = 0)
+{
+  refine (level < 6 && sq(x) + sq(y) < sq(0.25));
+  foreach()
+    f[] = x*y;
+}
+
+event allocate (i = 0; i <= 20; i += 8)
+  temporaries (10);
+
+event logfile (i++; i <= 20) {
+  double emax = 0.;
+  foreach (reduction(max:emax))
+    if (fabs (f[] - x*y) > emax)
+      emax = fabs (f[] - x*y);
+  fprintf (stderr, "%d %d %g\n", i, nvar(), emax);
+}
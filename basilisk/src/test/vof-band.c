@@ -0,0 +1,105 @@
+/**
+# Narrow-band VOF advection
+
+We check that the narrow-band sweeps of [vof.h](/src/vof.h) give
+the same results as the full sweeps (to within round-off) and that
+they conserve the total volume. Two copies of the same interface are
+advected in the time-reversed vortex of [reversed.c](reversed.c): `f`
+with the full sweeps and `g` with the narrow-band sweeps, first on a
+regular mesh and then on an adaptive mesh. */
+
+#include "advection.h"
+#include "vof.h"
+
+scalar f[], g[];
+scalar * interfaces = {f}, * tracers = NULL;
+
+#define circle(x,y) (sq(0.2) - (sq(x + 0.2) + sq(y + .236338)))
+const double T = 15.;
+int maxlevel = 0;
+double vf, vg;
+
+int main()
+{
+  origin (-0.5, -0.5);
+  DT = .1[0,1];
+  init_grid (128);
+  run();
+  maxlevel = 7;
+  vof_perf.cells = vof_perf.band = vof_perf.full = 0;
+  run();
+}
+
+event init (i = 0)
+{
+  if (maxlevel)
+    refine (level < maxlevel && circle(x,y) > - 0.01 && circle(x,y) < 0.01);
+  fraction (f, circle(x,y));
+  g.refine = g.prolongation = fraction_refine;
+  foreach()
+    g[] = f[];
+  vf = statsf(f).sum, vg = statsf(g).sum;
+}
+
+event velocity (i++) {
+  vertex scalar psi[];
+  double a = 1.5, k = pi;
+  foreach_vertex()
+    psi[] = - a*sin(2.*pi*t/T)*sin(k*(x + 0.5))*sin(k*(y + 0.5))/pi;
+  trash ({u});
+  coord f = {-1.,1.};
+  foreach_face()
+    u.x[] = f.x*(psi[0,1] - psi[])/Delta;
+}
+
+/**
+The field `g` is advected using the narrow-band sweeps, after `f`. */
+
+event vof (i++)
+{
+  vof_narrow_band = true;
+  vof_advection ({g}, i);
+  vof_narrow_band = false;
+}
+
+/**
+The two fields must be identical to within round-off (the band resets
+the volume fractions close to zero or one), and their total volumes
+conserved to within round-off. We also output the average
+fraction of cells in the band and the number of fallbacks to the full
+sweeps. */
+
+event logfile (t = {0,T}) {
+  double emax = 0.;
+  foreach (reduction(max:emax))
+    if (fabs (f[] - g[]) > emax)
+      emax = fabs (f[] - g[]);
+  double df = statsf(f).sum - vf, dg = statsf(g).sum - vg;
+  fprintf (stderr, "%g %d %d %d\n", t,
+	   fabs(df) < 1e-15, fabs(dg) < 1e-15, emax < 1e-10);
+}
+
+event end (t = T) {
+  fprintf (stderr, "band: %.3f full: %d\n",
+	   vof_perf.band/(double) vof_perf.cells, vof_perf.full);
+}
+
+/**
+The adaptive mesh follows both fields and an indicator of the
+neighborhood of the interface, so that the band is often (but not
+always) entirely at the finest level. `g` must use the same
+(conservative) refinement function as `f`. */
+
+event adapt (i++) {
+  if (maxlevel) {
+    scalar m[];
+    foreach() {
+      double mm = 0.;
+      foreach_neighbor()
+	if (f[] > 0. && f[] < 1.)
+	  mm = 1.;
+      m[] = mm;
+    }
+    adapt_wavelet ({f,g,m}, (double[]){1e-3,1e-3,1e-3}, maxlevel, 4);
+  }
+}
@@ -52,6 +52,8 @@ typedef struct {
   double max;   // Maximum MPI time (sec)
   size_t tnc;   // Number of grid points
   long   mem;   // Maximum resident memory (kB)
+  long   pool;  // Memory pools size (kB)
+  double frag;  // Fraction of memory pools not used by cells
 } timing;
 
 /**
@@ -83,6 +85,13 @@ timing timer_timing (timer t, int i, size_t tnc, double * mpi)
 #else
   s.mem = 0;
 #endif
+#if TREE
+  s.pool = mempool_stats.bytes/1024;
+  s.frag = mempool_stats.bytes ?
+    1. - mempool_stats.used/(double) mempool_stats.bytes : 0.;
+#else
+  s.pool = 0, s.frag = 0.;
+#endif
 #if _MPI
   if (mpi)
     MPI_Allgather (&s.avg, 1, MPI_DOUBLE, mpi, 1, MPI_DOUBLE, MPI_COMM_WORLD);
@@ -92,9 +101,12 @@ timing timer_timing (timer t, int i, size_t tnc, double * mpi)
   mpi_all_reduce (s.avg, MPI_DOUBLE, MPI_SUM);
   mpi_all_reduce (s.real, MPI_DOUBLE, MPI_SUM);
   mpi_all_reduce (s.mem, MPI_LONG, MPI_SUM);
+  mpi_all_reduce (s.pool, MPI_LONG, MPI_SUM);
+  mpi_all_reduce (s.frag, MPI_DOUBLE, MPI_MAX);
   s.real /= npe();
   s.avg /= npe();
   s.mem /= npe();
+  s.pool /= npe();
 #else
   s.min = s.max = s.avg = 0.;
 #endif
@@ -103,7 +115,14 @@ timing timer_timing (timer t, int i, size_t tnc, double * mpi)
 }
 
 /**
-This function writes timing statistics on standard output. */
+This function writes timing statistics on standard output. If
+*timer_stats* is set, it also writes [statistics on boundary
+conditions](grid/stencils.h) and on [restrictions](grid/multigrid-common.h),
+summed over all processes. Restrictions are only counted on multigrids
+and on uniform trees (on other trees they are done together with
+boundary conditions). */
+
+bool timer_stats = false;
 
 void timer_print (timer t, int i, size_t tnc)
 {
@@ -115,6 +134,25 @@ void timer_print (timer t, int i, size_t tnc)
 	   "\n# " GRIDNAME 
 	   ", %d steps, %g CPU, %.4g real, %.3g points.step/s, %d var\n",
 	   i, s.cpu, s.real, s.speed, (int) (datasize/sizeof(real)));
+  if (timer_stats) {
+    long b[3] = {boundary_stats.calls, boundary_stats.fields,
+		 boundary_stats.avoided};
+    mpi_all_reduce_array (b, MPI_LONG, MPI_SUM, 3);
+    fprintf (fout,
+	     "# boundary conditions: %ld calls, %ld fields, %ld avoided\n",
+	     b[0], b[1], b[2]);
+  }
+#if MULTIGRID
+  if (timer_stats) {
+    long r[3] = {restriction_stats.calls, restriction_stats.fields,
+		 restriction_stats.avoided};
+    mpi_all_reduce_array (r, MPI_LONG, MPI_SUM, 3);
+    if (r[0] || r[2]) // always zero on (non-uniform) trees
+      fprintf (fout,
+	       "# restrictions: %ld calls, %ld fields, %ld avoided\n",
+	       r[0], r[1], r[2]);
+  }
+#endif
 #if _MPI
   fprintf (fout,
 	   "# %d procs, MPI: min %.2g (%.2g%%) "
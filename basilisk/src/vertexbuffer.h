@@ -24,11 +24,65 @@ struct {
   int line_loop, lines, line_strip ;
   int quads, polygon, fan;
   int state;
+  Array * ops, * values; // the geometry being recorded (see below)
+  long maxrecord;        // the maximum size of the recording
 } VertexBuffer = {
   .visible = false, // traverse all vertices by default
   .modelview = { 1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1 }
 };
 
+/**
+## Recording and replaying geometries
+
+Independently of the vertex buffers above, the OpenGL commands
+generated by [draw.h]() can be recorded, while they are being
+executed. They can then be replayed, for example when the same
+geometry is drawn from a different viewpoint (see
+[cached_geometry()](draw.h#utility-functions)).
+
+Each command is stored as an opcode in the `ops` array, followed by
+its arguments in the `values` array. */
+
+enum {
+  GEOMETRY_BEGIN, GEOMETRY_END, GEOMETRY_VERTEX, GEOMETRY_NORMAL,
+  GEOMETRY_COLOR, GEOMETRY_TEXCOORD
+};
+
+static void vertex_buffer_record (unsigned char op, int n,
+				  double a, double b, double c)
+{
+  if (VertexBuffer.ops) {
+    if (VertexBuffer.ops->len + VertexBuffer.values->len >
+	VertexBuffer.maxrecord) {
+      // too large: stop recording
+      array_free (VertexBuffer.ops), VertexBuffer.ops = NULL;
+      array_free (VertexBuffer.values), VertexBuffer.values = NULL;
+      return;
+    }
+    array_append (VertexBuffer.ops, &op, 1);
+    if (n > 0) {
+      double v[3] = {a, b, c};
+      array_append (VertexBuffer.values, v, n*sizeof(double));
+    }
+  }
+}
+
+static void vertex_buffer_replay (const Array * ops, const Array * values)
+{
+  unsigned char * op = ops->p, * end = op + ops->len;
+  double * v = values->p;
+  for (; op < end; op++)
+    switch (*op) {
+    case GEOMETRY_BEGIN: glBegin (*v++); break;
+    case GEOMETRY_END: glEnd(); break;
+    case GEOMETRY_VERTEX: glVertex3d (v[0], v[1], v[2]); v += 3; break;
+    case GEOMETRY_NORMAL: glNormal3d (v[0], v[1], v[2]); v += 3; break;
+    case GEOMETRY_COLOR: glColor3f (v[0], v[1], v[2]); v += 3; break;
+    case GEOMETRY_TEXCOORD: glTexCoord1d (*v++); break;
+    default: assert (false);
+    }
+}
+
 static void vertex_buffer_push_index (unsigned int i)
 {
   i -= VertexBuffer.vertex;
@@ -60,6 +114,7 @@ void vertex_buffer_free()
 
 static void vertex_buffer_glBegin (unsigned int state)
 {
+  vertex_buffer_record (GEOMETRY_BEGIN, 1, state, 0, 0);
   if (VertexBuffer.index) {
 
     glGetFloatv (GL_MODELVIEW_MATRIX, VertexBuffer.modelview);
@@ -111,6 +166,7 @@ static void vertex_buffer_glBegin (unsigned int state)
 
 static void vertex_buffer_glEnd()
 {
+  vertex_buffer_record (GEOMETRY_END, 0, 0, 0, 0);
   if (VertexBuffer.index) {
     int type = -1;
     switch (VertexBuffer.state) {
@@ -187,6 +243,7 @@ static void vertex_buffer_glEnd()
 
 static void vertex_buffer_glColor3f (float r, float g, float b)
 {
+  vertex_buffer_record (GEOMETRY_COLOR, 3, r, g, b);
   if (VertexBuffer.color) {
     struct { float x, y, z; } color = {r, g, b}; // fixme: use r,g,b directly
     array_append (VertexBuffer.color, &color, 3*sizeof(float));
@@ -197,6 +254,7 @@ static void vertex_buffer_glColor3f (float r, float g, float b)
 
 static void vertex_buffer_glNormal3d (double nx, double ny, double nz)
 {
+  vertex_buffer_record (GEOMETRY_NORMAL, 3, nx, ny, nz);
   if (VertexBuffer.normal) {
     struct { float x, y, z; } normal = {nx, ny, nz};
     array_append (VertexBuffer.normal, &normal, 3*sizeof(float));
@@ -207,6 +265,7 @@ static void vertex_buffer_glNormal3d (double nx, double ny, double nz)
 
 static void vertex_buffer_glVertex3d (double x, double y, double z)
 {
+  vertex_buffer_record (GEOMETRY_VERTEX, 3, x, y, z);
   if (VertexBuffer.position) {
     if (VertexBuffer.dim < 3)
       VertexBuffer.dim = 3;
@@ -221,6 +280,7 @@ static void vertex_buffer_glVertex3d (double x, double y, double z)
 
 static void vertex_buffer_glVertex2d (double x, double y)
 {
+  vertex_buffer_record (GEOMETRY_VERTEX, 3, x, y, 0.);
   if (VertexBuffer.position) {
     if (VertexBuffer.dim < 2)
       VertexBuffer.dim = 2;
@@ -233,6 +293,12 @@ static void vertex_buffer_glVertex2d (double x, double y)
     glVertex3d (x, y, 0.);
 }
 
+static void vertex_buffer_glTexCoord1d (double s)
+{
+  vertex_buffer_record (GEOMETRY_TEXCOORD, 1, s, 0, 0);
+  glTexCoord1d (s);
+}
+
 /**
 Here we overload the default OpenGL commands, in order to call the
 corresponding vertex buffer operations defined above. */
@@ -244,3 +310,4 @@ corresponding vertex buffer operations defined above. */
 #define glVertex3d  vertex_buffer_glVertex3d
 #define glColor3f   vertex_buffer_glColor3f
 #define glNormal3d  vertex_buffer_glNormal3d
+#define glTexCoord1d vertex_buffer_glTexCoord1d
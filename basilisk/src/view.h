@@ -65,14 +65,19 @@ or by the Basilisk libraries in gl/. */
 ## A cache of "compiled" expressions
 
 The cache has a maximum size and least-used expressions are discarded
-first. */
+first. Each expression is stored together with its compiled program
+(see [draw.h](draw.h#compiling-expressions)) and the stamps of the
+fields it depends on, so that it can be re-evaluated when they
+change. */
 
 typedef struct {
   char * expr;
   scalar s;
+  struct _Program * program; // the compiled expression
+  unsigned long stamp;       // the stamps of its inputs
 } cexpr;
 
-static scalar get_cexpr (cexpr * cache, const char * expr)
+static cexpr * get_cexpr (cexpr * cache, const char * expr)
 {
   cexpr * c = cache;
   while (c->expr) {
@@ -83,15 +88,16 @@ static scalar get_cexpr (cexpr * cache, const char * expr)
       while ((c + 1)->expr)
 	*c = *(c + 1), c++;
       *c = tmp;
-      return c->s;
+      return c;
     }
     c++;
   }
-  return (scalar){-1};
+  return NULL;
 }
 
 static cexpr * add_cexpr (cexpr * cache, int maxlen,
-			  const char * expr, scalar s)
+			  const char * expr, scalar s,
+			  struct _Program * program, unsigned long stamp)
 {
   cexpr * c = cache;
   while (c->expr) c++;
@@ -104,6 +110,7 @@ static cexpr * add_cexpr (cexpr * cache, int maxlen,
     // discard first expression
     c = cache;
     free (c->expr);
+    free (c->program);
     scalar s = c->s;
     delete ({s});
     // shift remaining expressions
@@ -112,6 +119,8 @@ static cexpr * add_cexpr (cexpr * cache, int maxlen,
   }
   c->expr = strdup (expr);
   c->s = s;
+  c->program = program;
+  c->stamp = stamp;
   (c + 1)->expr = NULL;
   return cache;
 }
@@ -121,6 +130,7 @@ static void free_cexpr (cexpr * cache)
   cexpr * c = cache;
   while (c->expr) {
     free (c->expr);
+    free (c->program);
     scalar s = c->s;
     delete ({s});
     c++;
@@ -128,6 +138,87 @@ static void free_cexpr (cexpr * cache)
   free (cache);
 }
 
+/**
+## A cache of geometries
+
+The geometries generated by the drawing functions of [draw.h]() are
+stored as lists of OpenGL commands (see
+[vertexbuffer.h](vertexbuffer.h#recording-and-replaying-geometries)),
+indexed by a key which identifies the inputs used to generate them.
+
+As for expressions, the least-used geometries are discarded first,
+when the total size of the cache exceeds a maximum. */
+
+typedef struct {
+  char * key;
+  Array * ops, * values; // the recorded OpenGL commands
+  int ni;                // the number of items drawn
+} Geometry;
+
+static long geometry_size (const Geometry * g)
+{
+  return g->ops->len + g->values->len;
+}
+
+static Geometry * get_geometry (Geometry * cache, const char * key)
+{
+  Geometry * g = cache;
+  while (g && g->key) {
+    if (!strcmp (g->key, key)) {
+      // move this geometry to the top of the cache.
+      // the "top" is the last element.
+      Geometry tmp = *g;
+      while ((g + 1)->key)
+	*g = *(g + 1), g++;
+      *g = tmp;
+      return g;
+    }
+    g++;
+  }
+  return NULL;
+}
+
+static void free_geometry (Geometry * g)
+{
+  free (g->key);
+  array_free (g->ops);
+  array_free (g->values);
+}
+
+static Geometry * add_geometry (Geometry * cache, long maxsize, Geometry g)
+{
+  long size = geometry_size (&g);
+  int len = 0;
+  if (cache)
+    for (Geometry * c = cache; c->key; c++)
+      size += geometry_size (c), len++;
+  // discard the least-used geometries
+  while (len > 0 && size > maxsize) {
+    size -= geometry_size (cache);
+    free_geometry (cache);
+    for (Geometry * c = cache; c->key; c++)
+      *c = *(c + 1);
+    len--;
+  }
+  if (size > maxsize) {
+    free_geometry (&g);
+    return cache;
+  }
+  cache = realloc (cache, sizeof(Geometry)*(len + 2));
+  cache[len] = g;
+  cache[len + 1].key = NULL;
+  return cache;
+}
+
+static void free_geometries (Geometry * cache)
+{
+  if (cache) {
+    for (Geometry * g = cache; g->key; g++)
+      free_geometry (g);
+    free (cache);
+  }
+}
+
 /**
 ## The *bview* class
 
@@ -163,6 +254,10 @@ struct _bview {
 
   cexpr * cache; // a cache of compiled expressions
   int maxlen; // the maximum number of cached expressions
+  bool persistent; // whether cached expressions are kept between frames
+
+  Geometry * geometry; // a cache of geometries
+  long maxgeometry;    // the maximum size (in bytes) of the cache
 };
 
 typedef struct _bview bview;
@@ -191,6 +286,9 @@ bview * bview_new()
   p->samples = 4;
   p->width = 600*p->samples, p->height = 600*p->samples;
   p->maxlevel = -1;
+  p->cache = calloc (1, sizeof (cexpr));
+  p->maxlen = 8;
+  p->maxgeometry = 256 << 20;
   
   /* OpenGL somehow generates floating-point exceptions... turn them off */
   disable_fpe (FE_DIVBYZERO|FE_INVALID);
@@ -213,6 +311,7 @@ void bview_destroy (bview * p)
   framebuffer_destroy (p->fb);
   if (p->cache)
     free_cexpr (p->cache);
+  free_geometries (p->geometry);
   free (p);
 }
 
@@ -317,17 +416,82 @@ framebuffer images on each of the MPI processes. */
 
 typedef void * pointer; // fixme: trace is confused by pointers
 
+/**
+With MPI, the images are composed by direct-send by default. Setting
+*compose_reduce* to *true* reverts to the (simpler) reduction. This
+has no effect for serial runs. */
+
+bool compose_reduce = false;
+
 #if !_MPI
 trace
 static pointer compose_image (bview * view) {
   return framebuffer_image((view)->fb);
 }
 #else // _MPI
+
+/**
+With MPI, each process draws the part of the scene it owns and the
+images are then composed. For each pixel, the non-empty pixel (i.e.
+with a non-zero alpha) of the lowest rank is kept in 2D, and the
+closest one in 3D (the lowest rank wins for equal depths). In 3D, a
+pixel is empty if its depth is that of the background (*far*),
+whatever its alpha value. */
+
 #if dimension <= 2
 typedef struct {
   GLubyte a[4];
 } RGBA;
 
+#define pixel_in_front(in, out) true
+#define pixel_drawn(image, depth, i, far) ((image)[4*(i) + 3])
+
+static inline RGBA get_pixel (unsigned char * image, float * depth, long i)
+{
+  return ((RGBA *)image)[i];
+}
+
+static void append_pixels (Array * a, unsigned char * image, float * depth,
+			   long start, int len)
+{
+  array_append (a, image + 4*start, 4*len);
+}
+#else /* 3D */
+typedef struct {
+  GLubyte a[4];
+  float depth;
+} RGBA;
+
+#define pixel_in_front(in, out) ((in)->depth <= (out)->depth)
+#define pixel_drawn(image, depth, i, far) ((depth)[i] < (far))
+
+static inline RGBA get_pixel (unsigned char * image, float * depth, long i)
+{
+  RGBA p;
+  for (int j = 0; j < 4; j++)
+    p.a[j] = image[4*i + j];
+  p.depth = depth[i];
+  return p;
+}
+
+static void append_pixels (Array * a, unsigned char * image, float * depth,
+			   long start, int len)
+{
+  for (long i = start; i < start + len; i++) {
+    RGBA p = get_pixel (image, depth, i);
+    array_append (a, &p, sizeof (RGBA));
+  }
+}
+#endif /* 3D */
+
+/**
+### Composition using a reduction
+
+This is the simplest method: the entire image of each process is
+reduced on the root process. It is not used by default but is kept
+for comparison, see *compose_reduce* below. */
+
+#if dimension <= 2
 static void compose_image_op (void * pin, void * pout, int * len,
 			      MPI_Datatype * dptr)
 {
@@ -337,33 +501,22 @@ static void compose_image_op (void * pin, void * pout, int * len,
       *out = *rin;
 }
 
-trace
-static pointer compose_image (bview * view)
+static void compose_image_reduce (bview * view, unsigned char * image)
 {
-  unsigned char * image = framebuffer_image (view->fb);
-  assert (image);
-  if (npe() > 1) {
-    MPI_Op op;
-    MPI_Op_create (compose_image_op, true, &op);    
-    MPI_Datatype rgba;
-    MPI_Type_contiguous (4, MPI_BYTE, &rgba);
-    MPI_Type_commit (&rgba);
-    int size = view->width*view->height;
-    if (pid() == 0)
-      MPI_Reduce (MPI_IN_PLACE, image, size, rgba, op, 0, MPI_COMM_WORLD);
-    else
-      MPI_Reduce (image, image, size, rgba, op, 0, MPI_COMM_WORLD);
-    MPI_Op_free (&op);
-    MPI_Type_free (&rgba);
-  }
-  return image;
+  MPI_Op op;
+  MPI_Op_create (compose_image_op, true, &op);    
+  MPI_Datatype rgba;
+  MPI_Type_contiguous (4, MPI_BYTE, &rgba);
+  MPI_Type_commit (&rgba);
+  int size = view->width*view->height;
+  if (pid() == 0)
+    MPI_Reduce (MPI_IN_PLACE, image, size, rgba, op, 0, MPI_COMM_WORLD);
+  else
+    MPI_Reduce (image, image, size, rgba, op, 0, MPI_COMM_WORLD);
+  MPI_Op_free (&op);
+  MPI_Type_free (&rgba);
 }
 #else /* 3D */
-typedef struct {
-  GLubyte a[4];
-  float depth;
-} RGBA;
-
 static void compose_image_op (void * pin, void * pout, int * len,
 			      MPI_Datatype * dptr)
 {
@@ -373,47 +526,196 @@ static void compose_image_op (void * pin, void * pout, int * len,
       *out = *rin;
 }
 
+static void compose_image_reduce (bview * view, unsigned char * image)
+{
+  MPI_Op op;
+  MPI_Op_create (compose_image_op, true, &op);
+  MPI_Datatype rgba;
+  MPI_Type_create_struct (2,
+			  (int[]){4,1},
+			  (MPI_Aint[]){0,4},
+			  (MPI_Datatype[]){MPI_BYTE, MPI_FLOAT},
+			  &rgba);
+  MPI_Type_commit (&rgba);
+  float * depth = framebuffer_depth (view->fb);
+  int size = view->width*view->height;
+  RGBA * buf = malloc (size*sizeof(RGBA));
+  for (int i = 0; i < size; i++)
+    buf[i] = get_pixel (image, depth, i);
+  if (pid() == 0) {
+    MPI_Reduce (MPI_IN_PLACE, buf, size, rgba, op, 0, MPI_COMM_WORLD);
+    unsigned char * ptr = image;
+    for (int i = 0; i < size; i++)
+      for (int j = 0; j < 4; j++)
+	*ptr++ = buf[i].a[j];
+  }
+  else
+    MPI_Reduce (buf, buf, size, rgba, op, 0, MPI_COMM_WORLD);
+  free (buf);
+  MPI_Op_free (&op);
+  MPI_Type_free (&rgba);
+}
+#endif /* 3D */
+
+/**
+### Direct-send composition
+
+Each process composes a horizontal stripe of the image. The
+non-empty pixels within the bounding box of the local image are sent
+directly to the owners of the corresponding stripes, as runs of
+consecutive pixels. Since most of the image of each process is
+usually empty, this is much less data than the entire image. The
+composed stripes are then gathered on the root process. */
+
+typedef struct {
+  int start, len; // the first pixel (within the stripe) and the length
+} PixelRun;
+
+static int stripe_row (int rank, int height)
+{
+  return rank*(long) height/npe();
+}
+
+static void compose_image_direct (unsigned char * image, float * depth,
+				  int width, int height)
+{
+  int np = npe();
+
+  /**
+  In 3D, the depth of the background is the maximum depth over all
+  the images. */
+
+  float far = 0.;
+#if dimension > 2
+  far = - HUGE_VALF;
+  for (long i = 0; i < width*(long)height; i++)
+    if (depth[i] > far)
+      far = depth[i];
+  mpi_all_reduce (far, MPI_FLOAT, MPI_MAX);
+#endif
+  
+  /**
+  We then compute the bounding box of non-empty pixels. */
+  
+  int xmin = width, xmax = -1, ymin = height, ymax = -1;
+  for (int j = 0; j < height; j++) {
+    long row = j*(long)width;
+    int i = 0;
+    while (i < width && !pixel_drawn (image, depth, row + i, far)) i++;
+    if (i < width) {
+      if (j < ymin) ymin = j;
+      ymax = j;
+      if (i < xmin) xmin = i;
+      i = width - 1;
+      while (i > xmax && !pixel_drawn (image, depth, row + i, far)) i--;
+      if (i > xmax) xmax = i;
+    }
+  }
+
+  /**
+  The runs of non-empty pixels are encoded, in the order of the
+  stripes, i.e. of the destination processes. */
+  
+  int * scount = calloc (4*np, sizeof (int)), * sdispl = scount + np;
+  int * rcount = sdispl + np, * rdispl = rcount + np;
+  Array * a = array_new();
+  for (int j = ymin, r = 0; j <= ymax; j++) {
+    while (j >= stripe_row (r + 1, height))
+      r++;
+    long row = j*(long)width, len = a->len;
+    for (int i = xmin; i <= xmax; i++)
+      if (pixel_drawn (image, depth, row + i, far)) {
+	int i0 = i;
+	while (i <= xmax && pixel_drawn (image, depth, row + i, far))
+	  i++;
+	PixelRun run = {row + i0 - stripe_row (r, height)*(long)width, i - i0};
+	array_append (a, &run, sizeof (PixelRun));
+	append_pixels (a, image, depth, row + i0, i - i0);
+      }
+    scount[r] += a->len - len;
+  }
+  for (int r = 1; r < np; r++)
+    sdispl[r] = sdispl[r - 1] + scount[r - 1];
+  
+  MPI_Alltoall (scount, 1, MPI_INT, rcount, 1, MPI_INT, MPI_COMM_WORLD);
+  for (int r = 1; r < np; r++)
+    rdispl[r] = rdispl[r - 1] + rcount[r - 1];
+  char * rbuf = malloc (rdispl[np - 1] + rcount[np - 1] + 1);
+  MPI_Alltoallv (a->p, scount, sdispl, MPI_BYTE,
+		 rbuf, rcount, rdispl, MPI_BYTE, MPI_COMM_WORLD);
+  array_free (a);
+
+  /**
+  The local stripe is initialised with the (empty) background and the
+  runs received from each process are composed, starting from the
+  highest rank. */
+  
+  int row0 = stripe_row (pid(), height);
+  long n = (stripe_row (pid() + 1, height) - row0)*(long)width;
+  RGBA * stripe = malloc (n*sizeof (RGBA));
+  for (long i = 0; i < n; i++) {
+    stripe[i] = get_pixel (image, depth, row0*(long)width + i);
+#if dimension > 2
+    stripe[i].depth = HUGE_VALF;
+#endif
+  }
+  for (int r = np - 1; r >= 0; r--) {
+    char * p = rbuf + rdispl[r], * end = p + rcount[r];
+    while (p < end) {
+      PixelRun * run = (PixelRun *) p;
+      RGBA * in = (RGBA *)(p + sizeof (PixelRun)), * out = stripe + run->start;
+      for (int k = 0; k < run->len; k++, in++, out++)
+	if (pixel_in_front (in, out))
+	  *out = *in;
+      p = (char *) in;
+    }
+  }
+  free (rbuf);
+
+  /**
+  The stripes are gathered on the root process. */
+  
+  unsigned char * colors = image + 4*row0*(long)width;
+  if (pid() > 0)
+    colors = malloc (4*n);
+  for (long i = 0; i < n; i++)
+    for (int j = 0; j < 4; j++)
+      colors[4*i + j] = stripe[i].a[j];
+  free (stripe);
+  for (int r = 0; r < np; r++) {
+    rdispl[r] = 4*stripe_row (r, height)*width;
+    rcount[r] = 4*stripe_row (r + 1, height)*width - rdispl[r];
+  }
+  if (pid() == 0)
+    MPI_Gatherv (MPI_IN_PLACE, 4*n, MPI_BYTE,
+		 image, rcount, rdispl, MPI_BYTE, 0, MPI_COMM_WORLD);
+  else {
+    MPI_Gatherv (colors, 4*n, MPI_BYTE,
+		 image, rcount, rdispl, MPI_BYTE, 0, MPI_COMM_WORLD);
+    free (colors);
+  }
+  free (scount);
+}
+
 trace
 static pointer compose_image (bview * view)
 {
   unsigned char * image = framebuffer_image (view->fb);
   assert (image);
   if (npe() > 1) {
-    MPI_Op op;
-    MPI_Op_create (compose_image_op, true, &op);
-    MPI_Datatype rgba;
-    MPI_Type_create_struct (2,
-			    (int[]){4,1},
-			    (MPI_Aint[]){0,4},
-			    (MPI_Datatype[]){MPI_BYTE, MPI_FLOAT},
-			    &rgba);
-    MPI_Type_commit (&rgba);
-    float * depth = framebuffer_depth (view->fb);
-    int size = view->width*view->height;
-    RGBA * buf = malloc (size*sizeof(RGBA));
-    unsigned char * ptr = image;
-    float * dptr = depth;
-    for (int i = 0; i < size; i++) {
-      for (int j = 0; j < 4; j++)
-	buf[i].a[j] = *ptr++;
-      buf[i].depth = *dptr++;
-    }
-    if (pid() == 0) {
-      MPI_Reduce (MPI_IN_PLACE, buf, size, rgba, op, 0, MPI_COMM_WORLD);
-      unsigned char * ptr = image;
-      for (int i = 0; i < size; i++)
-	for (int j = 0; j < 4; j++)
-	  *ptr++ = buf[i].a[j];
+    if (compose_reduce)
+      compose_image_reduce (view, image);
+    else {
+#if dimension <= 2
+      float * depth = NULL;
+#else
+      float * depth = framebuffer_depth (view->fb);
+#endif
+      compose_image_direct (image, depth, view->width, view->height);
     }
-    else
-      MPI_Reduce (buf, buf, size, rgba, op, 0, MPI_COMM_WORLD);
-    free (buf);
-    MPI_Op_free (&op);
-    MPI_Type_free (&rgba);
   }
   return image;
 }
-#endif /* 3D */
 #endif /* _MPI */
 
 #include "vertexbuffer.h"
@@ -447,6 +749,13 @@ static void bview_draw (bview * view)
     return;
   view->active = false;
   glFinish ();
+
+  /* Expressions are only cached for the duration of a frame, unless
+     requested otherwise. */
+  if (!view->persistent && view->cache->expr) {
+    free_cexpr (view->cache);
+    view->cache = calloc (1, sizeof (cexpr));
+  }
   enable_fpe (FE_DIVBYZERO|FE_INVALID);
 }
 
@@ -470,10 +779,12 @@ The recognised file formats are:
 
 * "ppm": [Portable PixMap](https://en.wikipedia.org/wiki/Netpbm_format) 
          format. A basic uncompressed image format.
-* "png", "jpg": Compressed image formats. Will only work if the
-                *convert* command from
-                [ImageMagick](http://imagemagick.org) is installed on
-                the system.
+* "png": Compressed image format, written using the [built-in
+         encoder](png-encoder.h).
+* "jpg": Compressed image format. Will only work if the
+         *convert* command from
+         [ImageMagick](http://imagemagick.org) is installed on
+         the system.
 * "mp4", "gif", "ogv": Compressed animation formats. Will only work if
                        [ffmpeg](https://www.ffmpeg.org) is installed on 
                        the system.
@@ -518,7 +829,7 @@ bool save (char * file = NULL, char * format = "ppm", char * opt = NULL,
   if (!view)
     view = get_view();
 
-  if ((!strcmp (format, "png") && which ("convert")) ||
+  if ((file && !strcmp (format, "png")) ||
       !strcmp (format, "jpg") ||
       (file && is_animation (file))) {
     bview_draw (view);
@@ -561,8 +872,15 @@ bool save (char * file = NULL, char * format = "ppm", char * opt = NULL,
   else if (!strcmp (format, "png")) {
     bview_draw (view);
     unsigned char * image = (unsigned char *) compose_image (view);
-    if (pid() == 0)
-      gl_write_image_png (fp, image, view->width, view->height, view->samples);
+    if (pid() == 0) {
+      char * ppm = NULL;
+      size_t len = 0;
+      FILE * fppm = open_memstream (&ppm, &len);
+      gl_write_image (fppm, image, view->width, view->height, view->samples);
+      fclose (fppm);
+      png_write_ppm (fp, ppm, len);
+      sysfree (ppm);
+    }
   }
 
   else if (!strcmp (format, "bv")) {
@@ -656,6 +974,7 @@ bool process_line (char * line)
 	free_cexpr (view->cache);
 	view->cache = calloc (1, sizeof (cexpr));
       }
+      free_geometries (view->geometry), view->geometry = NULL;
       if (!restore (file = file, list = all))
 	fprintf (ferr, "could not restore from '%s'\n", file);
       else {
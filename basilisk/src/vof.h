@@ -33,6 +33,7 @@ attribute {
 We will need basic functions for volume fraction computations. */
 
 #include "fractions.h"
+#define VOF 1
 
 /**
 The list of volume fraction fields `interfaces`, will be provided by
@@ -152,13 +153,26 @@ dimension successively using a one-dimensional scheme.
 We implement the one-dimensional scheme along the x-dimension and use
 the [foreach_dimension()](/Basilisk C#foreach_dimension) operator to
 automatically derive the corresponding functions along the other
-dimensions. */
+dimensions.
+
+The volume fractions are advected as a batch: the list `interfaces`
+of volume fractions, together with the lists `ccl` of the
+corresponding centered volume fractions (defined below), `tracers` of
+all their VOF tracers and `tcl` of the corresponding concentrations,
+are updated within a single traversal of the grid. This shares the
+cost of the traversals, face velocity loads and boundary conditions
+between interfaces (for example for three-phase flows). */
 
 foreach_dimension()
-static void sweep_x (scalar c, scalar cc, scalar * tcl)
+static void sweep_x (scalar * interfaces, scalar * ccl,
+		     scalar * tracers, scalar * tcl)
 {
-  vector n[];
-  scalar alpha[], flux[];
+  vector * nl = NULL;
+  scalar * alphal = NULL, * fluxl = NULL;
+  for (scalar c in interfaces) {
+    scalar flux = new scalar;
+    fluxl = list_append (fluxl, flux);
+  }
   double cfl = 0.;
 
   /**
@@ -168,7 +182,7 @@ static void sweep_x (scalar c, scalar cc, scalar * tcl)
   upwinding) and we need to store the computed fluxes. We first
   allocate the corresponding lists. */
 
-  scalar * tracers = c.tracers, * gfl = NULL, * tfluxl = NULL;
+  scalar * gfl = NULL, * tfluxl = NULL;
   if (tracers) {
     for (scalar t in tracers) {
       scalar gf = new scalar, flux = new scalar;
@@ -177,21 +191,45 @@ static void sweep_x (scalar c, scalar cc, scalar * tcl)
     }
 
     /**
-    The gradient is computed using the "interface-biased" scheme above. */
+    The gradient is computed using the "interface-biased" scheme
+    above. The volume fraction associated with each tracer is stored
+    in its `c` attribute. */
 
     foreach() {
       scalar t, gf;
       for (t,gf in tracers,gfl)
-	gf[] = vof_concentration_gradient_x (point, c, t);
+	gf[] = vof_concentration_gradient_x (point, t.c, t);
     }
   }
   
   /**
   We reconstruct the interface normal $\mathbf{n}$ and the intercept
-  $\alpha$ for each cell. Then we go through each (vertical) face of
-  the grid. */
-
-  reconstruction (c, n, alpha);
+  $\alpha$ for each cell, or reuse the [cached
+  geometry](fractions.h#cached-interface-geometry) if it is still
+  valid (typically for the first sweep of a timestep). The
+  reconstructions of the other sweeps use temporary fields, so that
+  the cache is only filled once per timestep, after the last sweep
+  (see the `vof` event below). Then we go through each
+  (vertical) face of the grid. */
+
+  scalar * rl = NULL, * ralphal = NULL;
+  vector * rnl = NULL;
+  for (scalar c in interfaces)
+    if (interface_geometry_valid (c)) {
+      alphal = list_append (alphal, c.geometry);
+      nl = vectors_append (nl, c.geometry_n);
+    }
+    else {
+      vector n;
+      scalar alpha = geometry_new (&n);
+      alphal = list_append (alphal, alpha);
+      nl = vectors_append (nl, n);
+      rl = list_append (rl, c);
+      ralphal = list_append (ralphal, alpha);
+      rnl = vectors_append (rnl, n);
+    }
+  if (rl)
+    geometries_reconstruct (rl, rnl, ralphal);
   foreach_face(x, reduction (max:cfl)) {
 
     /**
@@ -222,36 +260,44 @@ static void sweep_x (scalar c, scalar cc, scalar * tcl)
     When the upwind cell is entirely full or empty we can avoid this
     computation. */
 
-    double cf = (c[i] <= 0. || c[i] >= 1.) ? c[i] :
-      rectangle_fraction ((coord){-s*n.x[i], n.y[i], n.z[i]}, alpha[i],
-			  (coord){-0.5, -0.5, -0.5},
-			  (coord){s*un - 0.5, 0.5, 0.5});
+    scalar c, alpha, flux;
+    vector n;
+    for (c, n, alpha, flux in interfaces, nl, alphal, fluxl) {
+      double cf = (c[i] <= 0. || c[i] >= 1.) ? c[i] :
+	rectangle_fraction ((coord){-s*n.x[i], n.y[i], n.z[i]}, alpha[i],
+			    (coord){-0.5, -0.5, -0.5},
+			    (coord){s*un - 0.5, 0.5, 0.5});
     
-    /**
-    Once we have the upwind volume fraction *cf*, the volume fraction
-    flux through the face is simply: */
+      /**
+      Once we have the upwind volume fraction *cf*, the volume fraction
+      flux through the face is simply: */
 
-    flux[] = cf*uf.x[];
+      flux[] = cf*uf.x[];
 
-    /**
-    If we are transporting tracers, we compute their flux using the
-    upwind volume fraction *cf* and a tracer value upwinded using the
-    Bell--Collela--Glaz scheme and the gradient computed above. */
+      /**
+      If we are transporting tracers, we compute their flux using the
+      upwind volume fraction *cf* and a tracer value upwinded using the
+      Bell--Collela--Glaz scheme and the gradient computed above. */
     
-    scalar t, gf, tflux;
-    for (t,gf,tflux in tracers,gfl,tfluxl) {
-      double cf1 = cf, ci = c[i];
-      if (t.inverse)
-	cf1 = 1. - cf1, ci = 1. - ci;
-      if (ci > 1e-10) {
-	double ff = t[i]/ci + s*min(1., 1. - s*un)*gf[i]*Delta/2.;
-	tflux[] = ff*cf1*uf.x[];
-      }
-      else
-	tflux[] = 0.;
+      scalar t, gf, tflux;
+      for (t,gf,tflux in tracers,gfl,tfluxl)
+	if (t.c.i == c.i) {
+	  double cf1 = cf, ci = c[i];
+	  if (t.inverse)
+	    cf1 = 1. - cf1, ci = 1. - ci;
+	  if (ci > 1e-10) {
+	    double ff = t[i]/ci + s*min(1., 1. - s*un)*gf[i]*Delta/2.;
+	    tflux[] = ff*cf1*uf.x[];
+	  }
+	  else
+	    tflux[] = 0.;
+	}
     }
   }
   delete (gfl); free (gfl);
+  delete (ralphal), delete ((scalar *) rnl);
+  free (rl), free (ralphal), free (rnl);
+  free (nl), free (alphal);
   
   /**
   We warn the user if the CFL condition has been violated. */
@@ -281,7 +327,9 @@ static void sweep_x (scalar c, scalar cc, scalar * tcl)
 
 #if !EMBED
   foreach() {
-    c[] += dt*(flux[] - flux[1] + cc[]*(uf.x[1] - uf.x[]))/(cm[]*Delta);
+    scalar c, cc, flux;
+    for (c, cc, flux in interfaces, ccl, fluxl)
+      c[] += dt*(flux[] - flux[1] + cc[]*(uf.x[1] - uf.x[]))/(cm[]*Delta);
 #if NO_1D_COMPRESSION
     scalar t, tflux;
     for (t, tflux in tracers, tfluxl)
@@ -302,8 +350,11 @@ static void sweep_x (scalar c, scalar cc, scalar * tcl)
   
   foreach()
     if (cs[] > 0.) {
-      c[] += dt*cs[]*(flux[] - flux[1] + cc[]*(uf.x[1] - uf.x[]))/(cm[]*Delta);
+      scalar c, cc, flux;
+      for (c, cc, flux in interfaces, ccl, fluxl)
+	c[] += dt*cs[]*(flux[] - flux[1] + cc[]*(uf.x[1] - uf.x[]))/(cm[]*Delta);
 #if NO_1D_COMPRESSION
+      scalar t, tflux;
       for (t, tflux in tracers, tfluxl)
 	t[] += dt*cs[]*(tflux[] - tflux[1])/(cm[]*Delta);
 #else // !NO_1D_COMPRESSION
@@ -314,9 +365,236 @@ static void sweep_x (scalar c, scalar cc, scalar * tcl)
     }
 #endif // EMBED
 
+  delete (fluxl); free (fluxl);
   delete (tfluxl); free (tfluxl);
 }
 
+/**
+## Narrow-band sweeps
+
+When the interfaces occupy a small fraction of the domain, most cells
+are surrounded by cells which are all full or all empty. For these
+cells the one-dimensional update above vanishes identically: the
+upwind volume fraction is `c[i] = c[]`, `cc[] = c[]` and the flux and
+compression terms cancel exactly, also in floating-point arithmetic.
+
+The CFL restriction of 0.5 ensures that the interface cannot move by
+more than one cell per sweep. A cell can thus only change during the
+successive sweeps of a timestep if its $3^d$ neighborhood initially
+contains either an interfacial cell or both full and empty cells. We
+call these cells the *band*.
+
+When `vof_narrow_band` is set, the band is rebuilt at the start of
+each timestep and the reconstruction and fluxes are only computed for
+band cells.
+
+In practice, the sweeps leave round-off errors (of order $10^{-16}$)
+in full and empty cells next to the interface and these errors then
+spread through the bulk, which would eventually put most cells in the
+band. Volume fractions within `vof_band_tolerance` of zero or one are
+thus first reset to exactly zero or one and the corresponding volume
+is added back to the interfacial cells, so that the total volume is
+still conserved to within round-off. The results thus differ from
+those of the full sweeps by round-off errors only.
+
+The narrow-band sweeps are only used on trees, without embedded
+boundaries and for volume fractions without VOF tracers (whose fluxes
+do not vanish in the bulk). If the band touches a resolution boundary
+or an interfacial boundary cell, the full sweeps are used for this
+timestep.
+
+The `vof_perf` structure accumulates the time spent in each sweep
+direction (for both methods), the time spent building the band, the
+number of leaf and band cells and the number of fallbacks to the full
+sweeps. */
+
+bool vof_narrow_band = false;
+double vof_band_tolerance = 1e-12;
+
+struct {
+  double build, sweep[dimension]; // wall-clock times (sec)
+  long cells, band;               // number of leaf and band cells
+  int full;                       // number of fallbacks to full sweeps
+} vof_perf = {0};
+
+#if TREE && !EMBED
+
+typedef struct {
+  Point p;
+  double cc, dc, cfl;
+} VofBandCell;
+
+typedef struct {
+  VofBandCell * p;
+  int n, nm;
+} VofBand;
+
+static VofBand vof_band = {NULL, 0, 0};
+
+static void vof_band_free (void)
+{
+  free (vof_band.p);
+  vof_band.p = NULL;
+  vof_band.n = vof_band.nm = 0;
+}
+
+macro2 foreach_band (VofBand * _band)
+{
+  OMP_PARALLEL() {
+    int ig = 0, jg = 0, kg = 0; NOT_UNUSED(ig); NOT_UNUSED(jg); NOT_UNUSED(kg);
+    Point point = {0}; NOT_UNUSED (point);
+    int _k;
+    OMP(omp for schedule(static))
+      for (_k = 0; _k < _band->n; _k++) {
+	VofBandCell * bcell = _band->p + _k; NOT_UNUSED (bcell);
+	point = bcell->p;
+	{...}
+      }
+  }
+}
+
+/**
+The volume fractions within `vof_band_tolerance` of zero or one are
+reset and the total volume removed is added back, uniformly, to the
+interfacial cells. */
+
+static void vof_band_reset (scalar c)
+{
+  double eps = vof_band_tolerance, dc = 0., vi = 0.;
+  foreach (reduction(+:dc) reduction(+:vi))
+    if (c[] < eps || c[] > 1. - eps)
+      dc += (c[] - (c[] > 0.5))*dv();
+    else
+      vi += dv();
+  if (dc == 0. || vi == 0.)
+    return;
+  dc /= vi;
+  foreach()
+    if (c[] < eps || c[] > 1. - eps)
+      c[] = (c[] > 0.5);
+    else
+      c[] += dc;
+}
+
+/**
+The band is then built from the leaf cells. A cell is outside the
+band if its neighborhood is either entirely empty or entirely
+full. The function returns `true` if the full sweeps must be used
+instead. */
+
+static bool vof_band_build (scalar c, VofBand * band)
+{
+  if (!band->p)
+    free_solver_func_add (vof_band_free);
+  band->n = 0;
+  int full = false;
+  vof_band_reset (c);
+  foreach (serial) {
+    double cmin = 1., cmax = 0.;
+    foreach_neighbor (1) {
+      if (c[] < cmin) cmin = c[];
+      if (c[] > cmax) cmax = c[];
+    }
+    if (cmin != cmax || (cmin != 0. && cmin != 1.)) {
+
+      /**
+      The fluxes of band cells must be consistent with those of
+      their neighbors i.e. the neighbors must be leaves at the same
+      level, or boundary cells which do not require the
+      reconstruction of the interface. */
+      
+      foreach_dimension()
+	for (int i = -1; i <= 1; i += 2)
+	  if (!is_leaf (neighbor(i)) &&
+	      (!is_boundary (neighbor(i)) || (c[i] > 0. && c[i] < 1.)))
+	    full = true;
+      if (band->n >= band->nm) {
+	band->nm += 1024;
+	qrealloc (band->p, band->nm, VofBandCell);
+      }
+      VofBandCell * b = band->p + band->n++;
+      b->p = point, b->cc = (c[] > 0.5);
+    }
+  }
+  mpi_all_reduce (full, MPI_INT, MPI_MAX);
+  return full;
+}
+
+/**
+The flux through the left face of a band cell is the same as that
+computed by the full sweep. The interface is reconstructed on the fly
+in the (interfacial) upwind cell. */
+
+foreach_dimension()
+static double vof_band_flux_x (Point point, scalar c, double * cfl)
+{
+  double un = uf.x[]*dt/(Delta*fm.x[] + SEPS), s = sign(un);
+  int i = -(s + 1.)/2.;
+  if (un*fm.x[]*s/(cm[] + SEPS) > *cfl)
+    *cfl = un*fm.x[]*s/(cm[] + SEPS);
+  double cf = c[i];
+  if (cf > 0. && cf < 1.) {
+    coord m = interface_normal (neighborp(i), c);
+    cf = rectangle_fraction ((coord){-s*m.x, m.y, m.z}, plane_alpha (c[i], m),
+			     (coord){-0.5, -0.5, -0.5},
+			     (coord){s*un - 0.5, 0.5, 0.5});
+  }
+  return cf*uf.x[];
+}
+
+foreach_dimension()
+static void sweep_band_x (scalar c, VofBand * band)
+{
+  boundary ({c});
+  foreach_band (band) {
+    bcell->cfl = 0.;
+    double fl = vof_band_flux_x (point, c, &bcell->cfl);
+    double fr = vof_band_flux_x (neighborp(1), c, &bcell->cfl);
+    bcell->dc = dt*(fl - fr + bcell->cc*(uf.x[1] - uf.x[]))/(cm[]*Delta);
+  }
+  double cfl = 0.;
+  foreach_band (band)
+    c[] += bcell->dc;
+  c.dirty = true, c.stamp++;
+  for (int k = 0; k < band->n; k++)
+    if (band->p[k].cfl > cfl)
+      cfl = band->p[k].cfl;
+  if (cfl > 0.5 + 1e-6)
+    fprintf (ferr, 
+	     "src/vof.h:%d: warning: CFL must be <= 0.5 for VOF (cfl - 0.5 = %g)\n", 
+	     LINENO, cfl - 0.5), fflush (ferr);
+}
+
+/**
+This function performs the narrow-band advection of `c`. It returns
+`false` if the full sweeps need to be used instead. */
+
+static bool vof_band_advection (scalar c, int i)
+{
+  timer t = timer_start();
+  bool full = vof_band_build (c, &vof_band);
+  vof_perf.build += timer_elapsed (t);
+  vof_perf.cells += grid->n;
+  if (full) {
+    vof_perf.full++;
+    return false;
+  }
+  vof_perf.band += vof_band.n;
+  boundary ((scalar *){uf});
+  void (* sweep[dimension]) (scalar, VofBand *);
+  int d = 0;
+  foreach_dimension()
+    sweep[d++] = sweep_band_x;
+  for (d = 0; d < dimension; d++) {
+    t = timer_start();
+    sweep[(i + d) % dimension] (c, &vof_band);
+    vof_perf.sweep[(i + d) % dimension] += timer_elapsed (t);
+  }
+  return true;
+}
+
+#endif // TREE && !EMBED
+
 /**
 ## Multi-dimensional advection
 
@@ -324,18 +602,32 @@ The multi-dimensional advection is performed by the event below. */
 
 void vof_advection (scalar * interfaces, int i)
 {
+
+  /**
+  We first define, for each interface, the volume fraction field used
+  to compute the divergent term in the one-dimensional advection
+  equation above. We follow [Weymouth & Yue,
+  2010](/src/references.bib#weymouth2010) and use a step function
+  which guarantees exact mass conservation for the multi-dimensional
+  advection scheme (provided the advection velocity field is exactly
+  non-divergent).
+
+  The interfaces (and their tracers) are then gathered into lists
+  which are advected together. */
+
+  scalar * cl = NULL, * ccl = NULL, * tracers = NULL, * tcl = NULL;
   for (scalar c in interfaces) {
 
-    /**
-    We first define the volume fraction field used to compute the
-    divergent term in the one-dimensional advection equation above. We
-    follow [Weymouth & Yue, 2010](/src/references.bib#weymouth2010) and use a
-    step function which guarantees exact mass conservation for the
-    multi-dimensional advection scheme (provided the advection velocity
-    field is exactly non-divergent). */
-
-    scalar cc[], * tcl = NULL, * tracers = c.tracers;    
-    for (scalar t in tracers) {
+#if TREE && !EMBED
+    if (vof_narrow_band && !c.tracers && vof_band_advection (c, i))
+      continue;
+#endif
+
+    scalar cc = new scalar;
+    cl = list_append (cl, c);
+    ccl = list_append (ccl, cc);
+    scalar * ctracers = c.tracers;
+    for (scalar t in ctracers) {
 #if !NO_1D_COMPRESSION
       scalar tc = new scalar;
       tcl = list_append (tcl, tc);
@@ -345,40 +637,63 @@ void vof_advection (scalar * interfaces, int i)
 	t.refine = t.prolongation = vof_concentration_refine;
 	t.restriction = restriction_volume_average;
 	t.dirty = true;
-	t.c = c;
       }
 #endif // TREE
+      t.c = c;
+      tracers = list_append (tracers, t);
     }
-    foreach() {
+  }
+  if (!cl)
+    return;
+
+  foreach() {
+    scalar c, cc;
+    for (c, cc in cl, ccl)
       cc[] = (c[] > 0.5);
 #if !NO_1D_COMPRESSION
-      scalar t, tc;
-      for (t, tc in tracers, tcl) {
-	if (t.inverse)
-	  tc[] = c[] < 0.5 ? t[]/(1. - c[]) : 0.;
-	else
-	  tc[] = c[] > 0.5 ? t[]/c[] : 0.;
-      }
-#endif // !NO_1D_COMPRESSION
+    scalar t, tc;
+    for (t, tc in tracers, tcl) {
+      scalar c = t.c;
+      if (t.inverse)
+	tc[] = c[] < 0.5 ? t[]/(1. - c[]) : 0.;
+      else
+	tc[] = c[] > 0.5 ? t[]/c[] : 0.;
     }
+#endif // !NO_1D_COMPRESSION
+  }
 
-    /**
-    We then apply the one-dimensional advection scheme along each
-    dimension. To try to minimise phase errors, we alternate dimensions
-    according to the parity of the iteration index `i`. */
-
-    void (* sweep[dimension]) (scalar, scalar, scalar *);
-    int d = 0;
-    foreach_dimension()
-      sweep[d++] = sweep_x;
-    for (d = 0; d < dimension; d++)
-      sweep[(i + d) % dimension] (c, cc, tcl);
-    delete (tcl), free (tcl);
+  /**
+  We then apply the one-dimensional advection scheme along each
+  dimension. To try to minimise phase errors, we alternate dimensions
+  according to the parity of the iteration index `i`. */
+
+  void (* sweep[dimension]) (scalar *, scalar *, scalar *, scalar *);
+  int d = 0;
+  foreach_dimension()
+    sweep[d++] = sweep_x;
+  for (d = 0; d < dimension; d++) {
+    timer t = timer_start();
+    sweep[(i + d) % dimension] (cl, ccl, tracers, tcl);
+    vof_perf.sweep[(i + d) % dimension] += timer_elapsed (t);
   }
+  delete (tcl), free (tcl);
+  delete (ccl), free (ccl);
+  free (cl), free (tracers);
 }
 
+/**
+The interface geometry is then reconstructed for the advected volume
+fractions, so that the [cached
+geometry](fractions.h#cached-interface-geometry) is valid for the
+events which follow (in particular the curvature used by
+[surface tension](tension.h)). If the mesh does not change, the first
+sweep of the next timestep also reuses it. */
+
 event vof (i++)
+{
   vof_advection (interfaces, i);
+  interface_geometries (interfaces);
+}
 
 /**
 ## References
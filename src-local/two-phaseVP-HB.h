@@ -72,6 +72,12 @@ event defaults (i = 0) {
   alpha = alphav;
   rho = rhov;
 
+  /**
+  $D_2$ is only a diagnostic: it does not need values on parent or
+  halo cells. */
+
+  D2.leafonly = true;
+
   /**
   If the viscosity is non-zero, we need to allocate the face-centered
   viscosity field. */